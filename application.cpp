@@ -11,9 +11,17 @@
 #include <unordered_map>
 #include <future>
 #include <optional>
+#include <cstdio>
+#include <cstring>
 
 #include <unistd.h>
 #include <signal.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 
 namespace appbase {
 
@@ -24,6 +32,35 @@ using std::cout;
 
 using any_type_compare_map = std::unordered_map<std::type_index, std::function<bool(const boost::any& a, const boost::any& b)>>;
 
+static constexpr const char* thread_role_names[] = { "main", "signal", "exec", "worker" };
+
+/// <role>-thread-* options
+struct thread_role_settings {
+   std::vector<int>   cpus;   ///< empty to leave the affinity alone
+   std::optional<int> policy;
+   std::optional<int> nice;   ///< real-time priority for SCHED_FIFO and SCHED_RR
+};
+
+#if defined(__linux__)
+/// affinity and scheduling of the thread that called initialize(), restored for settings a role leaves unconfigured
+struct thread_defaults {
+   cpu_set_t          cpus;
+   int                policy = SCHED_OTHER;
+   struct sched_param params{};
+   int                nice = 0;
+   bool               valid = false;
+
+   static thread_defaults of_current_thread() {
+      thread_defaults d;
+      CPU_ZERO( &d.cpus );
+      d.valid = sched_getaffinity( 0, sizeof(d.cpus), &d.cpus ) == 0 &&
+                pthread_getschedparam( pthread_self(), &d.policy, &d.params ) == 0;
+      d.nice = getpriority( PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)) );
+      return d;
+   }
+};
+#endif
+
 class application_impl {
    public:
       application_impl():_app_options("Application Options"){
@@ -68,15 +105,39 @@ class application_impl {
 
       std::atomic_bool        _is_quiting{false};
 
+      uint32_t                  _exec_batch_size = 1;
+      std::chrono::microseconds _exec_batch_time{0};
+      bool                      _exec_batch_adaptive = false;
+      std::chrono::nanoseconds  _busy_poll_max{0};      ///< exec-busy-poll-us, 0 to block right away
+      std::chrono::nanoseconds  _busy_poll_interval{0}; ///< current self-calibrated spin
+      application::busy_poll_stats _busy_poll_stats;
+
+      priority_thread_pool::scaling_config _worker_scaling; ///< worker-threads options
+      thread_role_settings                 _thread_roles[std::size(thread_role_names)];
+#if defined(__linux__)
+      thread_defaults                      _thread_defaults;
+#endif
+
       any_type_compare_map    _any_compare_map;
 
       std::thread             _signal_catching_thread;
       std::optional<boost::asio::io_context> _signal_catching_io_ctx;
+
+      std::optional<boost::asio::steady_timer>       _timer_wakeup; ///< drives application::timers on io_serv
+      execution_priority_queue::latency_stats        _timer_jitter;
 };
 
 application::application()
 :my(new application_impl()){
    io_serv = std::make_shared<boost::asio::io_service>();
+   my->_timer_wakeup.emplace(*io_serv);
+
+   // an exception thrown on a pool thread is rethrown from exec(), as it would be by a handler on the main thread
+   const auto rethrow_on_main = [this]( int priority, std::exception_ptr e ) {
+      post( priority, [e]() { std::rethrow_exception( e ); } );
+   };
+   exec_pool.set_exception_handler( rethrow_on_main );
+   worker_pool.set_exception_handler( rethrow_on_main );
 
    register_config_type<std::string>();
    register_config_type<bool>();
@@ -157,7 +218,8 @@ void application::startup() {
    //during startup, run a second thread to catch SIGINT/SIGTERM/SIGPIPE/SIGHUP
    boost::asio::io_service startup_thread_ios;
    setup_signal_handling_on_ios(startup_thread_ios, true);
-   std::thread startup_thread([&startup_thread_ios]() {
+   std::thread startup_thread([this, &startup_thread_ios]() {
+      apply_thread_role(thread_role::signal);
       startup_thread_ios.run();
    });
    auto clean_up_signal_thread = [&startup_thread_ios, &startup_thread]() {
@@ -165,6 +227,8 @@ void application::startup() {
       startup_thread.join();
    };
 
+   worker_pool.start( my->_worker_scaling );
+
    try {
       for( auto plugin : initialized_plugins ) {
          if( is_quiting() ) break;
@@ -230,7 +294,48 @@ void application::set_program_options()
    options_description app_cfg_opts( "Application Config Options" );
    options_description app_cli_opts( "Application Command Line Options" );
    app_cfg_opts.add_options()
-         ("plugin", bpo::value< vector<string> >()->composing(), "Plugin(s) to enable, may be specified multiple times");
+         ("plugin", bpo::value< vector<string> >()->composing(), "Plugin(s) to enable, may be specified multiple times")
+         ("exec-threads", bpo::value<uint16_t>()->default_value(1),
+          "Number of threads running prioritized handlers. Handlers posted with a key (post_keyed) are spread over the "
+          "additional threads, everything else stays on the main thread")
+         ("worker-threads", bpo::value<uint16_t>()->default_value(0),
+          "Number of threads running functions offloaded from the main thread that are kept running. With 0 no "
+          "worker thread is started until work is offloaded")
+         ("worker-threads-max", bpo::value<uint16_t>()->default_value(2),
+          "Maximum number of worker threads. Threads are added while handlers queue up or wait longer than "
+          "worker-grow-wait-us and removed after worker-idle-timeout-ms without work. Not above worker-threads "
+          "for a fixed size pool of worker-threads threads")
+         ("worker-grow-wait-us", bpo::value<uint32_t>()->default_value(1000),
+          "Add a worker thread when a handler waited longer than this many microseconds to start")
+         ("worker-idle-timeout-ms", bpo::value<uint32_t>()->default_value(5000),
+          "Remove a worker thread above worker-threads after it was idle for this many milliseconds")
+         ("exec-batch-size", bpo::value<uint32_t>()->default_value(1),
+          "Maximum number of prioritized handlers to execute between polls of io_service")
+         ("exec-batch-time-us", bpo::value<uint32_t>()->default_value(0),
+          "Maximum microseconds to spend executing prioritized handlers between polls of io_service, 0 for no limit")
+         ("exec-batch-adaptive", bpo::value<bool>()->default_value(false),
+          "Scale the number of prioritized handlers executed between polls of io_service from 1 up to exec-batch-size "
+          "with the depth of the priority queue")
+         ("exec-starvation-limit-ms", bpo::value<uint32_t>()->default_value(0),
+          "Prioritized handlers waiting longer than this many milliseconds run ahead of higher priority handlers, "
+          "oldest first. 0 for strict priority ordering")
+         ("exec-busy-poll-us", bpo::value<uint32_t>()->default_value(0),
+          "Poll for new work for up to this many microseconds before the main thread blocks, trading a core for "
+          "lower wake-up latency. The spin adapts to the observed gaps between work within this limit. 0 to disable");
+
+   const char* const thread_role_descriptions[] = { "the main thread running exec()", "the signal handling thread",
+                                                    "the additional exec-threads threads", "the worker pool threads" };
+   for( size_t r = 0; r < std::size(thread_role_names); ++r ) {
+      const std::string role = thread_role_names[r];
+      const std::string desc = thread_role_descriptions[r];
+      app_cfg_opts.add_options()
+            ((role + "-thread-cpus").c_str(), bpo::value<std::string>(),
+             ("CPUs to pin " + desc + " to, e.g. 2,4-5").c_str())
+            ((role + "-thread-policy").c_str(), bpo::value<std::string>(),
+             ("Scheduling policy of " + desc + ": other, batch, idle, fifo or rr").c_str())
+            ((role + "-thread-nice").c_str(), bpo::value<int>(),
+             ("Nice level of " + desc + ", or the real-time priority with the fifo and rr policies").c_str());
+   }
 
    app_cli_opts.add_options()
          ("help,h", "Print this help message and exit.")
@@ -247,6 +352,41 @@ void application::set_program_options()
    my->_app_options.add(app_cli_opts);
 }
 
+static thread_role_settings parse_thread_role(const bpo::variables_map& options, const std::string& role) {
+   thread_role_settings s;
+   if( options.count(role + "-thread-cpus") ) {
+      const std::string list = options.at(role + "-thread-cpus").as<std::string>();
+      vector<string> ranges;
+      boost::split(ranges, list, boost::is_any_of(","));
+      for( const std::string& range : ranges ) {
+         int first = -1, last = -1;
+         char dash = 0, extra = 0;
+         const int n = std::sscanf(range.c_str(), " %d %c %d %c", &first, &dash, &last, &extra);
+         if( n == 1 )
+            last = first;
+         if( (n != 1 && (n != 3 || dash != '-')) || first < 0 || last < first || last >= 1024 )
+            BOOST_THROW_EXCEPTION(std::runtime_error("Invalid CPU list '" + list + "' for " + role + "-thread-cpus"));
+         for( int cpu = first; cpu <= last; ++cpu )
+            s.cpus.push_back(cpu);
+      }
+   }
+   if( options.count(role + "-thread-policy") ) {
+      const std::string policy = options.at(role + "-thread-policy").as<std::string>();
+#if defined(__linux__)
+      const std::pair<const char*, int> policies[] = { {"other", SCHED_OTHER}, {"batch", SCHED_BATCH}, {"idle", SCHED_IDLE},
+                                                       {"fifo", SCHED_FIFO}, {"rr", SCHED_RR} };
+      for( const auto& p : policies )
+         if( policy == p.first )
+            s.policy = p.second;
+#endif
+      if( !s.policy )
+         BOOST_THROW_EXCEPTION(std::runtime_error("Unsupported scheduling policy '" + policy + "' for " + role + "-thread-policy"));
+   }
+   if( options.count(role + "-thread-nice") )
+      s.nice = options.at(role + "-thread-nice").as<int>();
+   return s;
+}
+
 bool application::initialize_impl(int argc, char** argv, vector<abstract_plugin*> autostart_plugins) {
    set_program_options();
 
@@ -372,6 +512,37 @@ bool application::initialize_impl(int argc, char** argv, vector<abstract_plugin*
       std::cerr << "         removing these items." << std::endl;
    }
 
+   exec_threads = options.at("exec-threads").as<uint16_t>();
+   if( exec_threads == 0 )
+      BOOST_THROW_EXCEPTION(std::runtime_error("exec-threads must be at least 1"));
+   my->_worker_scaling.min_threads = options.at("worker-threads").as<uint16_t>();
+   my->_worker_scaling.max_threads = options.at("worker-threads-max").as<uint16_t>();
+   if( my->_worker_scaling.max_threads == 0 && my->_worker_scaling.min_threads == 0 )
+      BOOST_THROW_EXCEPTION(std::runtime_error("worker-threads-max must be at least 1 when worker-threads is 0"));
+   my->_worker_scaling.grow_wait = std::chrono::microseconds(options.at("worker-grow-wait-us").as<uint32_t>());
+   my->_worker_scaling.idle_timeout = std::chrono::milliseconds(options.at("worker-idle-timeout-ms").as<uint32_t>());
+   my->_exec_batch_size = options.at("exec-batch-size").as<uint32_t>();
+   if( my->_exec_batch_size == 0 )
+      BOOST_THROW_EXCEPTION(std::runtime_error("exec-batch-size must be at least 1"));
+   my->_exec_batch_time = std::chrono::microseconds(options.at("exec-batch-time-us").as<uint32_t>());
+   my->_exec_batch_adaptive = options.at("exec-batch-adaptive").as<bool>();
+   if( auto limit = options.at("exec-starvation-limit-ms").as<uint32_t>() )
+      pri_queue.set_scheduling_mode( execution_priority_queue::scheduling_mode::aging, std::chrono::milliseconds(limit) );
+
+   my->_busy_poll_max = std::chrono::microseconds(options.at("exec-busy-poll-us").as<uint32_t>());
+   my->_busy_poll_interval = my->_busy_poll_max;
+
+   for( size_t r = 0; r < std::size(thread_role_names); ++r )
+      my->_thread_roles[r] = parse_thread_role( options, thread_role_names[r] );
+#if defined(__linux__)
+   my->_thread_defaults = thread_defaults::of_current_thread();
+#endif
+   exec_pool.set_thread_start( [this]( size_t index ) { apply_thread_role( thread_role::exec, index ); } );
+   worker_pool.set_thread_start( [this]( size_t index ) { apply_thread_role( thread_role::worker, index ); } );
+#ifndef _WIN32
+   boost::asio::post( *my->_signal_catching_io_ctx, [this]() { apply_thread_role( thread_role::signal ); } );
+#endif
+
    if(options.count("plugin") > 0)
    {
       auto plugins = options.at("plugin").as<std::vector<std::string>>();
@@ -398,6 +569,8 @@ bool application::initialize_impl(int argc, char** argv, vector<abstract_plugin*
 }
 
 void application::shutdown() {
+   // plugins may have handlers on the worker pool, finish running ones and drop the rest before tearing them down
+   worker_pool.stop();
    for(auto ritr = running_plugins.rbegin();
        ritr != running_plugins.rend(); ++ritr) {
       (*ritr)->shutdown();
@@ -421,6 +594,51 @@ bool application::is_quiting() const {
    return my->_is_quiting;
 }
 
+void application::apply_thread_role( thread_role role, size_t index ) {
+#if defined(__linux__)
+   const char* const role_name = thread_role_names[static_cast<size_t>(role)];
+   const thread_role_settings& s = my->_thread_roles[static_cast<size_t>(role)];
+   // renaming the main thread would rename the process as shown by ps and top
+   if( role != thread_role::main ) {
+      std::string name = index ? std::string(role_name) + "-" + std::to_string(index) : std::string(role_name);
+      pthread_setname_np( pthread_self(), name.substr(0, 15).c_str() );
+   }
+   // a thread inherits the settings of the thread creating it, e.g. a worker added while the main thread posts, so
+   // settings not configured for role are put back to those of the thread that called initialize()
+   const thread_defaults& d = my->_thread_defaults;
+   if( !s.cpus.empty() || d.valid ) {
+      cpu_set_t cpus = d.cpus;
+      if( !s.cpus.empty() ) {
+         CPU_ZERO( &cpus );
+         for( int cpu : s.cpus )
+            CPU_SET( cpu, &cpus );
+      }
+      if( sched_setaffinity( 0, sizeof(cpus), &cpus ) != 0 )
+         std::cerr << "ERROR: Unable to set CPU affinity of " << role_name << " thread: " << std::strerror(errno) << std::endl;
+   }
+   const bool real_time = s.policy && (*s.policy == SCHED_FIFO || *s.policy == SCHED_RR);
+   if( s.policy || d.valid ) {
+      int policy = d.policy;
+      struct sched_param params = d.params;
+      if( s.policy ) {
+         policy = *s.policy;
+         params = sched_param{};
+         if( real_time )
+            params.sched_priority = s.nice.value_or( sched_get_priority_min(*s.policy) );
+      }
+      if( int ret = pthread_setschedparam( pthread_self(), policy, &params ); ret != 0 )
+         std::cerr << "ERROR: Unable to set scheduling policy of " << role_name << " thread: " << std::strerror(ret) << std::endl;
+   }
+   if( (s.nice || d.valid) && !real_time ) {
+      // nice is per thread on Linux, only touched when it differs as lowering it needs privileges
+      const auto tid = static_cast<id_t>(syscall(SYS_gettid));
+      const int nice = s.nice.value_or( d.nice );
+      if( getpriority( PRIO_PROCESS, tid ) != nice && setpriority( PRIO_PROCESS, tid, nice ) != 0 )
+         std::cerr << "ERROR: Unable to set nice level of " << role_name << " thread: " << std::strerror(errno) << std::endl;
+   }
+#endif
+}
+
 void application::set_thread_priority_max() {
 #if __has_include(<pthread.h>)
    pthread_t this_thread = pthread_self();
@@ -443,16 +661,152 @@ void application::exec() {
    {
       boost::asio::io_service::work work(*io_serv);
       (void)work;
+      // from here on posts from this thread bypass io_service, pick up anything posted before so it keeps its order
+      exec_thread_id = std::this_thread::get_id();
+      pri_queue.drain_incoming();
+      pri_queue.allow_blocking( true );
+      if( exec_threads > 1 )
+         exec_pool.start( exec_threads - 1 );
+      // after starting threads from this one, which would inherit its CPU set and policy until they apply their own
+      apply_thread_role( thread_role::main );
+      const size_t max_batch = my->_exec_batch_size;
+      const auto batch_time = my->_exec_batch_time;
+      size_t batch = my->_exec_batch_adaptive ? 1 : max_batch;
+      const bool busy_poll = my->_busy_poll_max.count() != 0;
       bool more = true;
-      while( more || io_serv->run_one() ) {
+      while( more || (busy_poll ? busy_poll_one() : io_serv->run_one()) ) {
          while( io_serv->poll_one() ) {}
-         // execute the highest priority item
-         more = pri_queue.execute_highest();
+         // execute up to a batch of the highest priority items before polling io_service again
+         const auto batch_start = batch_time.count() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+         size_t executed = 0;
+         do {
+            more = pri_queue.execute_highest();
+         } while( more && ++executed < batch &&
+                  (!batch_time.count() || std::chrono::steady_clock::now() - batch_start < batch_time) );
+         if( my->_exec_batch_adaptive ) {
+            // grow while a backlog builds up, shrink back towards one handler per poll as it clears
+            const size_t depth = pri_queue.size();
+            if( depth > 2 * batch )
+               batch = std::min( batch * 2, max_batch );
+            else if( depth < batch / 2 )
+               batch = std::max<size_t>( batch / 2, 1 );
+         }
       }
 
+      // nothing drains the queue from here on, release posters blocked on a full priority before joining threads
+      pri_queue.allow_blocking( false );
+      exec_pool.stop();
       shutdown(); /// perform synchronous shutdown
    }
+   my->_timer_wakeup.reset();
    io_serv.reset();
+   exec_thread_id = std::thread::id();
+}
+
+/**
+ * Spin on io_service for up to the current interval before blocking in run_one(). The interval follows the gaps
+ * between work: a gap that a longer spin would have covered extends it, gaps beyond exec-busy-poll-us halve it,
+ * so an idle application spins less and less instead of burning its full limit on every wait.
+ */
+bool application::busy_poll_one() {
+   using namespace std::chrono;
+   auto& stats = my->_busy_poll_stats;
+   auto& interval = my->_busy_poll_interval;
+   const auto max_interval = my->_busy_poll_max;
+   const auto min_interval = std::max<nanoseconds>( max_interval / 64, microseconds(1) );
+
+   const auto start = steady_clock::now();
+   auto now = start;
+   do {
+      if( io_serv->poll_one() ) {
+         const auto gap = duration_cast<nanoseconds>( steady_clock::now() - start );
+         ++stats.hits;
+         stats.spun += gap;
+         return true;
+      }
+      now = steady_clock::now();
+   } while( now - start < interval );
+
+   ++stats.misses;
+   stats.spun += duration_cast<nanoseconds>( now - start );
+   const bool ran = io_serv->run_one();
+   const auto gap = duration_cast<nanoseconds>( steady_clock::now() - start );
+   if( gap <= max_interval )
+      interval = std::min( gap + gap / 4, max_interval );
+   else
+      interval = std::max( interval / 2, min_interval );
+   return ran;
+}
+
+application::busy_poll_stats application::exec_busy_poll_stats() const {
+   auto stats = my->_busy_poll_stats;
+   stats.interval = my->_busy_poll_interval;
+   return stats;
+}
+
+void application::wake_timers() {
+   if( std::this_thread::get_id() == exec_thread_id.load(std::memory_order_relaxed) )
+      rearm_timers();
+   else
+      boost::asio::post(*io_serv, [this]() { rearm_timers(); });
+}
+
+void application::rearm_timers() {
+   auto wakeup = timers.next_wakeup();
+   if( !wakeup ) {
+      my->_timer_wakeup->cancel();
+      return;
+   }
+   my->_timer_wakeup->expires_at( *wakeup );
+   my->_timer_wakeup->async_wait( [this]( const boost::system::error_code& ec ) {
+      if( ec )
+         return;
+      expire_timers();
+   } );
+}
+
+void application::expire_timers() {
+   timers.expire( std::chrono::steady_clock::now(), [this]( const timer_wheel::entry_ptr& e, auto scheduled ) {
+      pri_queue.add( e->priority_, [this, e, scheduled]() {
+         if( e->cancelled_ )
+            return;
+         my->_timer_jitter.record( std::chrono::steady_clock::now() - scheduled );
+         e->function_();
+      } );
+   } );
+   rearm_timers();
+}
+
+void application::run_coalesced( uint64_t key ) {
+   small_handler f;
+   {
+      std::lock_guard<std::mutex> g( coalesce_mtx );
+      auto itr = coalesced.find( key );
+      if( itr == coalesced.end() )
+         return; // already run by the handler queued at a higher or lower priority
+      f = std::move( itr->second.function );
+      coalesced.erase( itr );
+   }
+   f();
+}
+
+bool application::unschedule_coalesced( uint64_t key, uint64_t id ) {
+   std::lock_guard<std::mutex> g( coalesce_mtx );
+   auto itr = coalesced.find( key );
+   if( itr == coalesced.end() || itr->second.id != id )
+      return true; // entry already ran
+   if( --itr->second.scheduled > 0 )
+      return true; // still queued at its previous priority
+   coalesced.erase( itr );
+   return false;
+}
+
+execution_priority_queue::priority_stats application::priority_queue_stats(int priority) const {
+   return pri_queue.stats(priority);
+}
+
+const execution_priority_queue::latency_stats& application::timer_jitter_stats() const {
+   return my->_timer_jitter;
 }
 
 void application::write_default_config(const bfs::path& cfg_file) {
@@ -0,0 +1,90 @@
+// Copies and time per publish of block sized payloads through a channel with several subscribers, for each publish
+// overload and for the previous design, which captured the const Data& in the posted lambda as a const copy.
+#include <appbase/application.hpp>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace appbase;
+
+namespace {
+
+   /// a block sized payload that counts its copies
+   struct block {
+      static inline uint64_t copies = 0;
+
+      explicit block(size_t size) : bytes(size, 1) {}
+      block(const block& b) : bytes(b.bytes) { ++copies; }
+      block(block&&) = default;
+      block& operator=(const block& b) { bytes = b.bytes; ++copies; return *this; }
+      block& operator=(block&&) = default;
+
+      std::vector<char> bytes;
+   };
+
+   using block_channel = channel_decl<struct block_channel_tag, block>;
+
+   constexpr size_t block_size = 1024 * 1024;
+   constexpr size_t publishes = 200;
+   constexpr size_t subscribers = 3;
+
+   uint64_t consumed = 0;
+
+   void consume(const block& b) { consumed += static_cast<unsigned char>(b.bytes.front() + b.bytes.back()); }
+
+   struct mode {
+      const char*                  name;
+      std::function<void(block&&)> publish;
+   };
+
+   std::vector<mode> modes() {
+      auto& ch = app().get_channel<block_channel>();
+      return {
+         { "captured const copy (before)", [](block&& b) {
+              // the lambda captured by value from a const Data&, so it held a const copy copied on every move
+              const block& data = b;
+              app().post(priority::medium, [data]() {
+                 for( size_t s = 0; s < subscribers; ++s )
+                    consume(data);
+              });
+           } },
+         { "publish(const Data&)        ", [&ch](block&& b) { ch.publish(priority::medium, static_cast<const block&>(b)); } },
+         { "publish(Data&&)             ", [&ch](block&& b) { ch.publish(priority::medium, std::move(b)); } },
+         { "publish(shared_ptr)         ", [&ch](block&& b) { ch.publish(priority::medium, std::make_shared<const block>(std::move(b))); } },
+      };
+   }
+
+   /// publish a round in each mode, each publish with a freshly built payload, then report once it was delivered
+   void run(std::shared_ptr<std::vector<mode>> all, size_t next) {
+      if( next == all->size() ) {
+         app().quit();
+         return;
+      }
+      const uint64_t copies_before = block::copies;
+      const auto start = std::chrono::steady_clock::now();
+      for( size_t i = 0; i < publishes; ++i )
+         (*all)[next].publish(block(block_size));
+      app().post(priority::low, [all, next, copies_before, start]() {
+         const auto elapsed = std::chrono::steady_clock::now() - start;
+         std::cout << (*all)[next].name << ": " << double(block::copies - copies_before) / publishes << " copies/publish, "
+                   << std::chrono::duration<double, std::micro>(elapsed).count() / publishes << " us/publish\n";
+         run(all, next + 1);
+      });
+   }
+
+}
+
+int main(int argc, char** argv) {
+   if( !app().initialize(argc, argv) )
+      return -1;
+   app().startup();
+   std::vector<block_channel::channel_type::handle> handles;
+   for( size_t s = 0; s < subscribers; ++s )
+      handles.push_back(app().get_channel<block_channel>().subscribe([](const block& b) { consume(b); }));
+   app().post(priority::medium, []() { run(std::make_shared<std::vector<mode>>(modes()), 0); });
+   app().exec();
+   return consumed ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// Cost of posting to the application priority queue compared to the previous design, which posted every handler to
+// io_service wrapped by execution_priority_queue::wrap(). Measures throughput and per post cost on the producers as
+// the number of threads posting concurrently grows, and post to execute latency of posts made from the exec thread.
+#include <appbase/execution_priority_queue.hpp>
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+   using clock = std::chrono::steady_clock;
+
+   constexpr int priorities[] = { appbase::priority::low, appbase::priority::medium, appbase::priority::high };
+
+   enum class post_path {
+      asio,    ///< before: boost::asio::post of a wrapped handler, added to the queue once io_service runs it
+      direct   ///< now: add_concurrent() from other threads, add() from the exec thread
+   };
+
+   /// the loop of application::exec()
+   struct exec_loop {
+      boost::asio::io_service           ios;
+      appbase::execution_priority_queue q;
+
+      void run() {
+         auto work = boost::asio::make_work_guard(ios);
+         bool more = true;
+         while( more || ios.run_one() ) {
+            while( ios.poll_one() ) {}
+            more = q.execute_highest();
+         }
+      }
+
+      template <typename Func>
+      void post_concurrent(post_path path, int priority, Func&& func) {
+         if( path == post_path::asio ) {
+            boost::asio::post(ios, q.wrap(priority, std::forward<Func>(func)));
+         } else if( q.add_concurrent(priority, std::forward<Func>(func)) == appbase::execution_priority_queue::add_result::queued_first ) {
+            boost::asio::post(ios, [this]() { q.drain_incoming(); });
+         }
+      }
+   };
+
+   void cross_thread(const char* name, post_path path, size_t producers) {
+      constexpr size_t per_producer = 200000;
+      const size_t total = producers * per_producer;
+      exec_loop loop;
+      size_t executed = 0;
+      std::atomic<bool> go{false};
+      std::atomic<uint64_t> posting_ns{0};
+      std::vector<std::thread> threads;
+      for( size_t t = 0; t < producers; ++t ) {
+         threads.emplace_back([&]() {
+            while( !go.load() )
+               std::this_thread::yield();
+            const auto start = clock::now();
+            for( size_t i = 0; i < per_producer; ++i ) {
+               loop.post_concurrent(path, priorities[i % 3], [&loop, &executed, total]() {
+                  if( ++executed == total )
+                     loop.ios.stop();
+               });
+            }
+            posting_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+         });
+      }
+      const auto start = clock::now();
+      go = true;
+      loop.run();
+      const auto elapsed = clock::now() - start;
+      for( auto& t : threads )
+         t.join();
+      std::cout << name << ", " << producers << " producer(s): "
+                << total / std::chrono::duration<double>(elapsed).count() / 1e6 << " M handlers/s, "
+                << double(posting_ns.load()) / total << " ns/post on producers\n";
+   }
+
+   void hop(exec_loop& loop, post_path path, size_t left) {
+      if( left == 0 ) {
+         loop.ios.stop();
+         return;
+      }
+      auto next = [&loop, path, left]() { hop(loop, path, left - 1); };
+      if( path == post_path::asio )
+         boost::asio::post(loop.ios, loop.q.wrap(appbase::priority::medium, std::move(next)));
+      else
+         loop.q.add(appbase::priority::medium, std::move(next));
+   }
+
+   /// each handler posts the next one from the exec thread
+   void same_thread(const char* name, post_path path) {
+      constexpr size_t hops = 1000000;
+      exec_loop loop;
+      boost::asio::post(loop.ios, [&]() { hop(loop, path, hops); });
+      const auto start = clock::now();
+      loop.run();
+      const auto elapsed = clock::now() - start;
+      std::cout << name << ", same thread: " << std::chrono::duration<double, std::nano>(elapsed).count() / hops
+                << " ns post to execute\n";
+   }
+
+}
+
+int main() {
+   same_thread("io_service post (before)", post_path::asio);
+   same_thread("direct add             ", post_path::direct);
+   for( size_t producers : { 1, 2, 4, 8 } ) {
+      cross_thread("io_service post (before)", post_path::asio, producers);
+      cross_thread("incoming stack         ", post_path::direct, producers);
+   }
+   return 0;
+}
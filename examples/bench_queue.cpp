@@ -0,0 +1,103 @@
+// Allocations and time per handler of execution_priority_queue compared to the previous design, which allocated
+// every queued handler with new and kept unique_ptrs in a std::deque based heap.
+#include <appbase/execution_priority_queue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <queue>
+
+static std::atomic<uint64_t> allocations{0};
+static volatile uint64_t     sink = 0; // keeps handler bodies from being optimized away
+
+void* operator new(std::size_t size) {
+   ++allocations;
+   if( void* p = std::malloc(size ? size : 1) )
+      return p;
+   throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+   /// the queue as it was before handler pooling
+   class legacy_queue {
+      public:
+         template <typename Function>
+         void add(int priority, Function function) {
+            handlers_.push(std::unique_ptr<queued_handler_base>(new queued_handler<Function>(priority, ++order_, std::move(function))));
+         }
+
+         bool execute_highest() {
+            if( handlers_.empty() )
+               return false;
+            handlers_.top()->execute();
+            handlers_.pop();
+            return !handlers_.empty();
+         }
+
+      private:
+         struct queued_handler_base {
+            queued_handler_base(int p, uint64_t o) : priority(p), order(o) {}
+            virtual ~queued_handler_base() = default;
+            virtual void execute() = 0;
+            int      priority;
+            uint64_t order;
+         };
+
+         template <typename Function>
+         struct queued_handler : queued_handler_base {
+            queued_handler(int p, uint64_t o, Function f) : queued_handler_base(p, o), function(std::move(f)) {}
+            void execute() override { function(); }
+            Function function;
+         };
+
+         struct deref_less {
+            bool operator()(const std::unique_ptr<queued_handler_base>& a, const std::unique_ptr<queued_handler_base>& b) const {
+               return a->priority < b->priority || (a->priority == b->priority && a->order > b->order);
+            }
+         };
+
+         std::priority_queue<std::unique_ptr<queued_handler_base>, std::deque<std::unique_ptr<queued_handler_base>>, deref_less> handlers_;
+         uint64_t order_ = 0;
+   };
+
+   constexpr int    priorities[] = { appbase::priority::low, appbase::priority::medium, appbase::priority::high };
+   constexpr size_t rounds = 200;
+   constexpr size_t batch = 1000;
+
+   template <typename Queue>
+   void run(const char* name, Queue& q) {
+      char payload[32] = {}; // a capture the size of a few pointers, typical of posted lambdas
+      auto fill = [&]() {
+         for( size_t i = 0; i < batch; ++i )
+            q.add(priorities[i % 3], [i, payload]() { sink = sink + i + payload[0]; });
+         while( q.execute_highest() ) {}
+      };
+      fill(); // warm up pools and containers
+      const uint64_t before = allocations.load();
+      const auto start = std::chrono::steady_clock::now();
+      for( size_t r = 0; r < rounds; ++r )
+         fill();
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      const double handlers = double(rounds * batch);
+      std::cout << name << ": " << (allocations.load() - before) / handlers << " allocations/handler, "
+                << std::chrono::duration<double, std::nano>(elapsed).count() / handlers << " ns/handler\n";
+   }
+
+}
+
+int main() {
+   legacy_queue legacy;
+   run("new + unique_ptr (before)", legacy);
+   appbase::execution_priority_queue pooled;
+   run("pooled small_handler     ", pooled);
+   return 0;
+}
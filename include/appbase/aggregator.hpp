@@ -0,0 +1,83 @@
+#pragma once
+#include <appbase/timer_wheel.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace appbase {
+
+   /**
+    * Collects items posted one at a time from any thread and hands them to a single handler in batches, with one
+    * prioritized queue entry per dispatch instead of one per item.
+    *
+    * Batches hold at most max_batch items. Batches are dispatched once one is full, or max_delay after the first
+    * item of a partial batch was posted, whichever comes first. A single queue entry delivers every batch collected
+    * by the time it runs, in posting order. The handler runs on the application thread and may move items out of
+    * the vector; vectors are recycled to keep their capacity.
+    *
+    * Example:
+    *    aggregator<transaction> txs( priority::medium, 256, std::chrono::milliseconds(1),
+    *                                 []( std::vector<transaction>& batch ) { process( batch ); } );
+    *    txs.post( std::move(trx) );
+    *
+    * @tparam Item - the type of the collected items
+    */
+   template<typename Item>
+   class aggregator {
+      public:
+         using batch_handler = std::function<void(std::vector<Item>&)>;
+
+         /**
+          * @param priority priority at which batches are queued
+          * @param max_batch number of items that dispatches a batch right away, at least 1
+          * @param max_delay longest time the first item of a batch waits before the batch is dispatched, zero
+          *                  dispatches on the first post
+          * @param handler called with each batch
+          */
+         aggregator( int priority, size_t max_batch, std::chrono::steady_clock::duration max_delay, batch_handler handler )
+         : my( std::make_shared<state>( priority, max_batch ? max_batch : 1, max_delay, std::move(handler) ) ) {}
+
+         /**
+          * Add an item to the current batch. Safe to call from any thread. Batches already queued for dispatch
+          * when the aggregator is destroyed are delivered, a partial batch still waiting for max_delay is discarded.
+          */
+         void post( Item item );
+
+         /// Number of items collected and not yet handed to the handler
+         size_t pending() const {
+            std::lock_guard<std::mutex> g( my->mtx );
+            size_t n = my->pending.size();
+            for( const auto& b : my->ready )
+               n += b.size();
+            return n;
+         }
+
+      private:
+         struct state {
+            state( int p, size_t b, std::chrono::steady_clock::duration d, batch_handler h )
+            : priority(p), max_batch(b), max_delay(d), handler(std::move(h)) {}
+
+            const int                                  priority;
+            const size_t                               max_batch;
+            const std::chrono::steady_clock::duration  max_delay;
+            const batch_handler                        handler;
+
+            mutable std::mutex               mtx;
+            std::vector<Item>                pending;        ///< partial batch filled by post()
+            std::vector<std::vector<Item>>   ready;          ///< full batches waiting for dispatch
+            std::vector<std::vector<Item>>   spare;          ///< emptied batches, reused to keep their capacity
+            std::vector<std::vector<Item>>   dispatching;    ///< only used by dispatch() on the application thread
+            bool                             queued = false; ///< a dispatch is in the priority queue
+            timer_handle                     timer;          ///< armed while a partial batch waits for max_delay
+         };
+
+         static void schedule( const std::shared_ptr<state>& s );
+         static void dispatch( state& s );
+
+         std::shared_ptr<state> my;
+   };
+
+}
@@ -2,10 +2,21 @@
 #include <appbase/plugin.hpp>
 #include <appbase/channel.hpp>
 #include <appbase/method.hpp>
+#include <appbase/aggregator.hpp>
+#include <appbase/task.hpp>
 #include <appbase/execution_priority_queue.hpp>
+#include <appbase/priority_thread_pool.hpp>
+#include <appbase/parallel.hpp>
+#include <appbase/result_future.hpp>
+#include <appbase/timer_wheel.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/core/demangle.hpp>
+#include <boost/throw_exception.hpp>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <typeindex>
+#include <unordered_map>
 
 namespace appbase {
    namespace bpo = boost::program_options;
@@ -13,6 +24,14 @@ namespace appbase {
 
    using config_comparison_f = std::function<bool(const boost::any& a, const boost::any& b)>;
 
+   /// Threads of the application that can be given CPU affinity and a scheduling policy, see apply_thread_role()
+   enum class thread_role {
+      main,   ///< thread running exec()
+      signal, ///< signal handling thread
+      exec,   ///< additional exec-threads threads
+      worker  ///< worker pool threads
+   };
+
    class application
    {
       public:
@@ -193,7 +212,7 @@ namespace appbase {
             if(itr != channels.end()) {
                return *channel_type::get_channel(itr->second);
             } else {
-               channels.emplace(std::make_pair(key, channel_type::make_unique()));
+               channels.emplace(std::make_pair(key, channel_type::make_unique(ChannelDecl::mode)));
                return  *channel_type::get_channel(channels.at(key));
             }
          }
@@ -205,17 +224,335 @@ namespace appbase {
          boost::asio::io_service& get_io_service() { return *io_serv; }
 
          /**
-          * Post func to run on io_service with given priority.
+          * Post func to run on io_service with given priority. Safe to call from any thread.
+          *
+          * When called from the thread running exec() the handler is added directly to the priority queue.
+          * From other threads it goes onto the lock-free incoming stack of the priority queue. Only the post that
+          * finds the stack empty wakes up exec(), all posts made before that drain runs are moved into the queue
+          * together.
+          *
+          * A priority can be bounded with get_priority_queue().set_capacity(). When it is full, depending on its
+          * overflow policy the post is rejected, the oldest handler of that priority is dropped, or a thread other
+          * than the one running exec() blocks until there is room.
           *
           * @param priority can be appbase::priority::* constants or any int, larger ints run first
           * @param func function to run on io_service
-          * @return result of boost::asio::post
+          * @return false if func was rejected because priority is at capacity
+          */
+         template <typename Func>
+         bool post( int priority, Func&& func ) {
+            return post_to_queue( priority, std::forward<Func>(func), cancellation_token() );
+         }
+
+         /**
+          * Same as post() but the handler can be revoked until it starts.
+          *
+          * Cancelling is O(1): the entry stays queued and is skipped when reached, and the queue is compacted once
+          * cancelled entries make up half of it. See execution_priority_queue::cancelled_count().
+          *
+          * @return token whose cancel() prevents func from running, already cancelled() if func was rejected
+          */
+         template <typename Func>
+         cancellation_token post_cancellable( int priority, Func&& func ) {
+            cancellation_token token = pri_queue.make_cancellation_token();
+            post_to_queue( priority, std::forward<Func>(func), token );
+            return token;
+         }
+
+         /**
+          * Post func to run with given priority, serialized with every other handler posted with the same key.
+          *
+          * With exec-threads > 1, keyed handlers run on the additional exec threads, in parallel with handlers
+          * of other keys and with the main thread, so they must not touch state owned by the main thread.
+          * Handlers of one key run one at a time in priority then FIFO order. With a single exec thread this is
+          * the same as post(). An exception thrown by func on an exec thread is rethrown from exec() by a handler
+          * posted at priority, and later handlers of the key still run.
+          *
+          * @param priority can be appbase::priority::* constants or any int, larger ints run first
+          * @param key ordering key, handlers sharing a key never run concurrently
+          * @param func function to run
+          */
+         template <typename Func>
+         void post_keyed( int priority, uint64_t key, Func&& func ) {
+            if( exec_threads > 1 )
+               exec_pool.post(priority, key, std::forward<Func>(func));
+            else
+               post(priority, std::forward<Func>(func));
+         }
+
+         /**
+          * Post func unless a handler with the same key is still pending, in which case that handler is replaced by
+          * func in place. Only the latest func posted for a key runs. Safe to call from any thread.
+          *
+          * Pending handlers are kept in a hashed index next to the priority queue. A post with a higher priority
+          * than the pending one moves it up to that priority, a lower priority never moves it down.
+          *
+          * @param key identifies what func updates, e.g. a hash of "refresh peer X"
+          * @param priority can be appbase::priority::* constants or any int, larger ints run first
+          * @param func function to run
+          * @return false if func was rejected because priority is at capacity
+          */
+         template <typename Func>
+         bool post_coalesced( uint64_t key, int priority, Func&& func ) {
+            uint64_t id = 0;
+            {
+               std::lock_guard<std::mutex> g( coalesce_mtx );
+               auto r = coalesced.try_emplace( key );
+               coalesced_handler& c = r.first->second;
+               c.function = small_handler( std::forward<Func>(func) );
+               if( r.second ) {
+                  c.id = ++next_coalesced_id;
+               } else {
+                  ++coalesced_posts;
+                  if( priority <= c.priority )
+                     return true;
+               }
+               // new entry, or a raise: whichever queued handler runs first takes the entry, later ones find nothing
+               c.priority = priority;
+               ++c.scheduled;
+               id = c.id;
+            }
+            if( post( priority, [this, key]() { run_coalesced( key ); } ) )
+               return true;
+            return unschedule_coalesced( key, id );
+         }
+
+         /// Number of post_coalesced() calls that replaced a pending handler instead of queueing one
+         uint64_t coalesced_post_count() const { return coalesced_posts; }
+
+         /**
+          * Post func and get its return value back through a future, e.g. from a thread that needs state owned by
+          * the main thread. Safe to call from any thread.
+          *
+          * The future's shared state comes from a recycled per thread pool, so the common case does not allocate.
+          * If func is rejected by a priority at capacity, or never runs, get() throws std::future_error.
+          *
+          * @param priority can be appbase::priority::* constants or any int, larger ints run first
+          * @param func function to run, exceptions it throws are rethrown by get()
+          */
+         template <typename Func>
+         auto post_with_result( int priority, Func&& func ) -> result_future<std::invoke_result_t<std::decay_t<Func>&>> {
+            using result_type = std::invoke_result_t<std::decay_t<Func>&>;
+            auto* state = detail::result_state<result_type>::acquire();
+            post( priority, [p = detail::result_promise<result_type>( state ), f = std::forward<Func>(func)]() mutable {
+               p.set_from( f );
+            } );
+            return result_future<result_type>( state );
+         }
+
+         /**
+          * Run func on the application's worker pool, in parallel with the main thread and other worker handlers.
+          * Safe to call from any thread.
+          *
+          * The pool is shared by all plugins instead of each running its own threads. Its threads, worker-threads
+          * growing up to worker-threads-max under load, pick up handlers in priority order, larger priorities first
+          * and FIFO within a priority, using the same appbase::priority constants as post(). By default no thread
+          * runs until work is posted. The pool starts before plugins start up and stops before they shut down:
+          * running handlers complete, handlers still waiting are discarded. An exception thrown by func is rethrown from exec() by a handler posted at priority.
+          *
+          * @param priority can be appbase::priority::* constants or any int, larger ints run first
+          * @param func function to run, must not touch state owned by the main thread
           */
          template <typename Func>
-         auto post( int priority, Func&& func ) {
-            return boost::asio::post(*io_serv, pri_queue.wrap(priority, std::forward<Func>(func)));
+         void post_parallel( int priority, Func&& func ) {
+            worker_pool.post( priority, std::forward<Func>(func) );
+         }
+
+         /**
+          * Handlers run and busy time of each worker pool thread, see post_parallel(). Safe to call from any thread.
+          */
+         std::vector<priority_thread_pool::thread_stats> worker_pool_stats() const {
+            return worker_pool.stats();
          }
 
+         /**
+          * Threads added and removed by an elastic worker pool, see the worker-threads-max option.
+          * Safe to call from any thread.
+          */
+         priority_thread_pool::scaling_stats worker_pool_scaling_stats() const {
+            return worker_pool.scaling();
+         }
+
+         /**
+          * Run func on the worker pool, then then(result), or then() if func returns void, on the main thread at the
+          * given priority. Safe to call from any thread. Blocking work such as file or network IO belongs here
+          * rather than in a handler on the main thread.
+          *
+          * func is queued like post_parallel(). An exception thrown by func is rethrown from a handler at priority
+          * instead of calling then. If func is discarded without running because the worker pool stopped, a
+          * std::future_error with std::future_errc::broken_promise is rethrown that way instead. The handler calling
+          * then, or rethrowing, is not counted against the capacity of priority, so it is never rejected or dropped.
+          *
+          * @param func function to run on a worker thread
+          * @param priority priority of func on the worker pool and of then in the priority queue
+          * @param then continuation receiving the result of func
+          */
+         template <typename Func, typename Then>
+         void offload( Func&& func, int priority, Then&& then ) {
+            auto run = [this, priority, f = std::forward<Func>(func), t = std::forward<Then>(then)]() mutable {
+               using result_type = std::invoke_result_t<std::decay_t<Func>&>;
+               try {
+                  if constexpr( std::is_void<result_type>::value ) {
+                     f();
+                     post_unbounded( priority, std::move(t) );
+                  } else {
+                     post_unbounded( priority, [t = std::move(t), r = f()]() mutable { t( std::move(r) ); } );
+                  }
+               } catch( ... ) {
+                  post_unbounded( priority, [e = std::current_exception()]() { std::rethrow_exception( e ); } );
+               }
+            };
+            worker_pool.post( priority, detail::make_discardable( std::move(run), [this, priority]() noexcept {
+               try {
+                  post_unbounded( priority, []() { throw std::future_error( std::future_errc::broken_promise ); } );
+               } catch( ... ) {} // out of memory, nothing left to report it with
+            } ) );
+         }
+
+         /**
+          * Call fn(i) for every i in [begin, end) on the worker pool, then on_done() on the main thread at priority.
+          * Safe to call from any thread.
+          *
+          * The range is split over the worker threads, which steal from each other once done with their share. fn
+          * is called concurrently and must be safe to call from several threads. If fn throws, remaining items are
+          * skipped and the first exception is rethrown from a handler at priority instead of calling on_done. If
+          * items are left unprocessed because the worker pool stopped, a std::future_error with
+          * std::future_errc::broken_promise is rethrown that way instead. The handler calling on_done, or rethrowing,
+          * is not counted against the capacity of priority, so it is never rejected or dropped.
+          *
+          * @param priority priority of the work on the worker pool and of on_done in the priority queue
+          */
+         template <typename Fn, typename Done>
+         void parallel_for( int priority, size_t begin, size_t end, Fn&& fn, Done&& on_done ) {
+            auto body = [fn = std::forward<Fn>(fn)]( size_t, size_t first, size_t last ) {
+               for( size_t i = first; i < last; ++i )
+                  fn( i );
+            };
+            run_parallel( priority, begin, end, parallel_participants( begin, end ), std::move(body),
+                          [done = std::forward<Done>(on_done)]() mutable { done(); } );
+         }
+
+         /**
+          * Reduce fn(i) for every i in [begin, end) with combine on the worker pool, then call on_done(result) on the
+          * main thread at priority. Safe to call from any thread.
+          *
+          * Each worker folds its items into its own partial result starting from init, the partial results are then
+          * folded in order starting from init. init must therefore be an identity of combine, e.g. 0 for a sum, and
+          * combine must be associative. Work is split and exceptions are handled as with parallel_for().
+          *
+          * @param priority priority of the work on the worker pool and of on_done in the priority queue
+          * @param fn maps an index to a T
+          * @param combine T combine(T, T)
+          * @param on_done called with the result
+          */
+         template <typename T, typename Fn, typename Combine, typename Done>
+         void parallel_reduce( int priority, size_t begin, size_t end, T init, Fn&& fn, Combine&& combine, Done&& on_done ) {
+            struct alignas(64) partial { T value; }; // one cache line each, participants update theirs constantly
+            const size_t participants = parallel_participants( begin, end );
+            auto partials = std::make_shared<std::vector<partial>>( participants, partial{ init } );
+            auto reduce = std::make_shared<std::decay_t<Combine>>( std::forward<Combine>(combine) );
+            auto body = [partials, reduce, fn = std::forward<Fn>(fn)]( size_t participant, size_t first, size_t last ) {
+               T& acc = (*partials)[participant].value;
+               for( size_t i = first; i < last; ++i )
+                  acc = (*reduce)( std::move(acc), fn( i ) );
+            };
+            auto finish = [partials, reduce, init = std::move(init), done = std::forward<Done>(on_done)]() mutable {
+               T result = std::move(init);
+               for( partial& p : *partials )
+                  result = (*reduce)( std::move(result), std::move(p.value) );
+               done( std::move(result) );
+            };
+            run_parallel( priority, begin, end, participants, std::move(body), std::move(finish) );
+         }
+
+         /**
+          * Priority of the handler running on the exec() thread when called from it, priority::medium on other
+          * threads.
+          */
+         int running_priority() const {
+            const bool on_exec = std::this_thread::get_id() == exec_thread_id.load(std::memory_order_relaxed);
+            return on_exec ? pri_queue.current_priority() : priority::medium;
+         }
+
+#ifdef APPBASE_HAS_COROUTINES
+         /**
+          * co_await from a task coroutine to re-queue the rest of it at the priority of the handler running it, so
+          * that higher priority work queued meanwhile runs first. Outside of the exec() thread priority::medium
+          * is used.
+          */
+         priority_awaitable yield() {
+            return priority_awaitable( running_priority() );
+         }
+
+         /**
+          * co_await from a task coroutine to continue it on the exec() thread at the given priority.
+          */
+         priority_awaitable schedule( int priority ) {
+            return priority_awaitable( priority );
+         }
+#endif
+
+         /**
+          * Run func with given priority once delay has elapsed. Safe to call from any thread.
+          *
+          * Timers are kept in a hierarchical timer wheel with millisecond resolution owned by the application,
+          * arming and cancelling are O(1). All timers expiring together are added to the priority queue in one batch.
+          *
+          * @param delay minimum time before func is queued
+          * @param priority can be appbase::priority::* constants or any int, larger ints run first
+          * @param func function to run
+          * @return handle that can cancel the timer, dropping it does not cancel
+          */
+         template <typename Func>
+         timer_handle post_after( std::chrono::steady_clock::duration delay, int priority, Func&& func ) {
+            return arm_timer( delay, std::chrono::steady_clock::duration::zero(), priority, std::forward<Func>(func) );
+         }
+
+         /**
+          * Run func with given priority every period, first after one period. Safe to call from any thread.
+          *
+          * Expiries are scheduled relative to the previous scheduled time rather than when func ran, so the timer does
+          * not drift; periods missed entirely are skipped. The delay between scheduled time and func starting is
+          * reported by timer_jitter_stats().
+          *
+          * @param period must be positive, throws std::runtime_error otherwise
+          * @return handle that can cancel the timer, dropping it does not cancel
+          */
+         template <typename Func>
+         timer_handle post_every( std::chrono::steady_clock::duration period, int priority, Func&& func ) {
+            // a zero period arms a one-shot timer
+            if( period <= std::chrono::steady_clock::duration::zero() )
+               BOOST_THROW_EXCEPTION(std::runtime_error("post_every period must be positive"));
+            return arm_timer( period, period, priority, std::forward<Func>(func) );
+         }
+
+         /**
+          * Enqueue/dequeue counts, depth, wait and run time histograms of prioritized handlers.
+          * Call from the exec() thread, e.g. from a posted handler. Only depth is available when built with
+          * APPBASE_QUEUE_STATS=0.
+          *
+          * @param priority one of the appbase::priority constants, all other priorities are reported together
+          */
+         execution_priority_queue::priority_stats priority_queue_stats(int priority) const;
+
+         /**
+          * Time from scheduled expiry of post_after() and post_every() timers until their handler started.
+          */
+         const execution_priority_queue::latency_stats& timer_jitter_stats() const;
+
+         struct busy_poll_stats {
+            uint64_t                  hits = 0;   ///< spins that found work before the interval ran out
+            uint64_t                  misses = 0; ///< spins that ran out and blocked
+            std::chrono::nanoseconds  spun{0};    ///< total time spent spinning
+            std::chrono::nanoseconds  interval{0}; ///< current spin interval, self-calibrated up to exec-busy-poll-us
+         };
+
+         /**
+          * Outcome of the exec-busy-poll-us spins exec() does before blocking for work.
+          * Call from the exec() thread, e.g. from a posted handler.
+          */
+         busy_poll_stats exec_busy_poll_stats() const;
+
          /**
           * Provide access to execution priority queue so it can be used to wrap functions for
           * prioritized execution.
@@ -228,6 +565,13 @@ namespace appbase {
             return pri_queue;
          }
 
+         /**
+          * Pool running post_parallel() and offload() functions, e.g. to subscribe to a channel off the main thread.
+          */
+         priority_thread_pool& get_worker_pool() {
+            return worker_pool;
+         }
+
          const bpo::variables_map& get_options() const;
 
          /**
@@ -236,6 +580,18 @@ namespace appbase {
           */
          void set_thread_priority_max();
 
+         /**
+          * Name the calling thread after role, unless it is the main thread, and apply the CPU set, scheduling policy
+          * and nice level configured for role with the <role>-thread-cpus, -policy and -nice options. Done
+          * automatically for the application's own threads, plugins may call it from threads they create.
+          * Settings not configured for role are reset to those the thread calling initialize() had, rather than
+          * inherited from the thread that created the calling one. Only supported on Linux, a no-op elsewhere;
+          * failures are reported on stderr.
+          *
+          * @param index appended to the thread name when non-zero, e.g. worker-3
+          */
+         void apply_thread_role( thread_role role, size_t index = 0 );
+
       protected:
          template<typename Impl>
          friend class plugin;
@@ -262,12 +618,91 @@ namespace appbase {
 
          std::shared_ptr<boost::asio::io_service>  io_serv;
          execution_priority_queue                  pri_queue;
+         std::atomic<std::thread::id>              exec_thread_id; ///< thread running exec(), default id otherwise
+         uint16_t                                  exec_threads = 1; ///< exec-threads option
+         priority_thread_pool                      exec_pool; ///< runs post_keyed() handlers when exec_threads > 1
+         priority_thread_pool                      worker_pool; ///< runs post_parallel() and offload() functions
+         timer_wheel                               timers; ///< post_after() and post_every() timers
+
+         struct coalesced_handler {
+            small_handler function;
+            int           priority = 0;
+            uint64_t      id = 0;        ///< tells successive entries of one key apart
+            uint32_t      scheduled = 0; ///< queued handlers that may run this entry
+         };
+         std::mutex                                      coalesce_mtx;
+         std::unordered_map<uint64_t, coalesced_handler> coalesced; ///< pending post_coalesced() handlers by key
+         uint64_t                                        next_coalesced_id = 0;
+         std::atomic<uint64_t>                           coalesced_posts{0};
 
+         bool busy_poll_one();
          void start_sighup_handler( std::shared_ptr<boost::asio::signal_set> sighup_set );
          void set_program_options();
          void write_default_config(const bfs::path& cfg_file);
          void print_default_config(std::ostream& os);
 
+         template <typename Func>
+         bool post_to_queue( int priority, Func&& func, const cancellation_token& token ) {
+            if( std::this_thread::get_id() == exec_thread_id.load(std::memory_order_relaxed) )
+               return pri_queue.add(priority, std::forward<Func>(func), token);
+            switch( pri_queue.add_concurrent(priority, std::forward<Func>(func), token) ) {
+               case execution_priority_queue::add_result::rejected:
+                  return false;
+               case execution_priority_queue::add_result::queued_first:
+                  boost::asio::post(*io_serv, [this]() { pri_queue.drain_incoming(); });
+                  break;
+               case execution_priority_queue::add_result::queued:
+                  break;
+            }
+            return true;
+         }
+
+         /// post() not counted against the capacity of priority, for handlers reporting the outcome of other work
+         template <typename Func>
+         void post_unbounded( int priority, Func&& func ) {
+            if( pri_queue.add_concurrent_unbounded(priority, std::forward<Func>(func)) == execution_priority_queue::add_result::queued_first )
+               boost::asio::post(*io_serv, [this]() { pri_queue.drain_incoming(); });
+         }
+
+         template <typename Func>
+         timer_handle arm_timer( std::chrono::steady_clock::duration delay, std::chrono::steady_clock::duration period,
+                                 int priority, Func&& func ) {
+            bool earlier = false;
+            auto handle = timers.arm( std::chrono::steady_clock::now() + delay, period, priority, std::forward<Func>(func), earlier );
+            if( earlier )
+               wake_timers();
+            return handle;
+         }
+         size_t parallel_participants( size_t begin, size_t end ) const {
+            // an elastic pool grows while the participants queue up, one without threads starts them on demand
+            return begin < end ? std::min( std::max<size_t>( worker_pool.max_threads(), 1 ), end - begin ) : 0;
+         }
+
+         /// post one job participant per worker, the last one to finish posts done, or the first exception, at priority
+         template <typename Body, typename Done>
+         void run_parallel( int priority, size_t begin, size_t end, size_t participants, Body&& body, Done&& done ) {
+            auto finish = [this, priority, done = std::forward<Done>(done)]( std::exception_ptr e ) mutable {
+               if( e )
+                  post_unbounded( priority, [e]() { std::rethrow_exception( e ); } );
+               else
+                  post_unbounded( priority, std::move(done) );
+            };
+            if( participants == 0 ) {
+               finish( nullptr );
+               return;
+            }
+            using job_type = detail::parallel_job<std::decay_t<Body>, decltype(finish)>;
+            auto job = std::make_shared<job_type>( begin, end, participants, std::forward<Body>(body), std::move(finish) );
+            for( size_t p = 0; p < participants; ++p )
+               worker_pool.post( priority, detail::make_discardable( [job, p]() { job->run( p ); }, [job]() noexcept { job->discard(); } ) );
+         }
+
+         void run_coalesced( uint64_t key );
+         bool unschedule_coalesced( uint64_t key, uint64_t id );
+         void wake_timers();
+         void rearm_timers();
+         void expire_timers();
+
          void wait_for_signal(std::shared_ptr<boost::asio::signal_set> ss);
          void setup_signal_handling_on_ios(boost::asio::io_service& ios, bool startup);
 
@@ -333,12 +768,350 @@ namespace appbase {
 
    template<typename Data, typename DispatchPolicy>
    void channel<Data,DispatchPolicy>::publish(int priority, const Data& data) {
-      if (has_subscribers()) {
-         // this will copy data into the lambda
-         app().post( priority, [this, data]() {
-            _signal(data);
+      if (_latest) {
+         store(priority, std::make_shared<const Data>(data));
+      } else if (_batch) {
+         if (has_subscribers())
+            append(priority, std::make_shared<const Data>(data));
+      } else if (_state->mailboxes() || _state->batch_subscribers()) {
+         deliver(priority, std::make_shared<const Data>(data));
+      } else if (has_subscribers()) {
+         // this will copy data into the lambda, once: a plain [data] capture would be const and copied again on
+         // every move of the handler into the queue
+         app().post( priority, [this, data = data]() {
+            _state->dispatch(data);
+         });
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::publish(int priority, Data&& data) {
+      if (_latest) {
+         store(priority, std::make_shared<const Data>(std::move(data)));
+      } else if (_batch) {
+         if (has_subscribers())
+            append(priority, std::make_shared<const Data>(std::move(data)));
+      } else if (_state->mailboxes() || _state->batch_subscribers()) {
+         deliver(priority, std::make_shared<const Data>(std::move(data)));
+      } else if (has_subscribers()) {
+         app().post( priority, [this, data = std::move(data)]() {
+            _state->dispatch(data);
+         });
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::publish(int priority, std::shared_ptr<const Data> data) {
+      if (_latest) {
+         store(priority, std::move(data));
+      } else if (_batch) {
+         if (has_subscribers())
+            append(priority, std::move(data));
+      } else if (_state->mailboxes()) {
+         deliver(priority, std::move(data));
+      } else if (has_subscribers()) {
+         app().post( priority, [this, data = std::move(data)]() {
+            _state->dispatch(data);
+         });
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::deliver(int priority, std::shared_ptr<const Data> data) {
+      const auto now = std::chrono::steady_clock::now();
+      bool shared_dispatch = false;
+      _state->read([&](const snapshot& s) {
+         shared_dispatch = !s.subscribers.empty() || !s.batch_subscribers.empty();
+         post_to_mailboxes(_state, s, data, now);
+      });
+      if (shared_dispatch) {
+         app().post( priority, [this, data = std::move(data)]() {
+            _state->dispatch(data);
+         });
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::post_to_mailboxes(const std::shared_ptr<state>& s, const snapshot& snap,
+                                                        const std::shared_ptr<const Data>& data,
+                                                        std::chrono::steady_clock::time_point published, bool conflate) {
+      for (const subscriber_ptr& sub : snap.mailboxes)
+         post_to_mailbox(s, sub, data, published, conflate);
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::post_to_mailbox(const std::shared_ptr<state>& s, const subscriber_ptr& sub,
+                                                      const std::shared_ptr<const Data>& data,
+                                                      std::chrono::steady_clock::time_point published, bool conflate) {
+      {
+         std::lock_guard<std::mutex> g(sub->box->mtx);
+         if (conflate)
+            sub->box->items.clear();
+         sub->box->items.emplace_back(data, published);
+         if (sub->box->scheduled)
+            return;
+         sub->box->scheduled = true;
+      }
+      schedule(s, sub);
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   auto channel<Data,DispatchPolicy>::add(subscriber_ptr sub) -> handle {
+      _state->add(sub);
+      if (_latest)
+         replay(sub);
+      return handle(_state, sub);
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::store(int priority, std::shared_ptr<const Data> data) {
+      {
+         // kept even without subscribers, for replay to later ones
+         std::lock_guard<std::mutex> g(_latest->mtx);
+         _latest->value = std::move(data);
+         _latest->published = std::chrono::steady_clock::now();
+         _latest->priority = priority;
+         if (_latest->queued || !has_subscribers())
+            return;
+         _latest->queued = true;
+      }
+      if (!app().post( priority, [this]() { deliver_latest(); } )) {
+         // rejected by a priority at capacity, the value waits for the delivery queued by the next publish
+         std::lock_guard<std::mutex> g(_latest->mtx);
+         _latest->queued = false;
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::deliver_latest() {
+      std::shared_ptr<const Data> value;
+      std::chrono::steady_clock::time_point published;
+      {
+         std::lock_guard<std::mutex> g(_latest->mtx);
+         _latest->queued = false;
+         value = _latest->value;
+         published = _latest->published;
+      }
+      _state->dispatch(value);
+      if (_state->mailboxes()) {
+         _state->read([&](const snapshot& s) {
+            post_to_mailboxes(_state, s, value, published, true);
+         });
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::replay(const subscriber_ptr& sub) {
+      int priority;
+      {
+         std::lock_guard<std::mutex> g(_latest->mtx);
+         // a queued delivery reads the subscribers when it runs, so it already covers sub
+         if (!_latest->value || _latest->queued)
+            return;
+         if (sub->box) {
+            // under the lock, a concurrent publish must not be replaced in the mailbox by the older value
+            post_to_mailbox(_state, sub, _latest->value, _latest->published, true);
+            return;
+         }
+         priority = _latest->priority;
+      }
+      // hand over the value current when this runs, so a replay never follows a newer delivery with an older value
+      app().post( priority, [this, sub]() {
+         if (!sub->connected.load(std::memory_order_relaxed))
+            return;
+         std::shared_ptr<const Data> value;
+         {
+            std::lock_guard<std::mutex> g(_latest->mtx);
+            value = _latest->value;
+         }
+         if (sub->batch_callback)
+            _state->dispatch(sub, batch_type{value});
+         else
+            _state->dispatch(sub, *value);
+      });
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::append(int priority, std::shared_ptr<const Data> data) {
+      {
+         std::lock_guard<std::mutex> g(_batch->mtx);
+         if (_batch->pending.empty())
+            _batch->first_published = std::chrono::steady_clock::now();
+         _batch->pending.push_back(std::move(data));
+         if (_batch->queued && priority <= _batch->queued_priority)
+            return;
+         _batch->queued = true;
+         _batch->queued_priority = priority;
+      }
+      if (!app().post( priority, [this]() { deliver_batch(); } )) {
+         // rejected by a priority at capacity, the batch waits for the delivery queued by the next publish
+         std::lock_guard<std::mutex> g(_batch->mtx);
+         _batch->queued = false;
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::deliver_batch() {
+      batch_type items;
+      std::chrono::steady_clock::time_point published;
+      {
+         std::lock_guard<std::mutex> g(_batch->mtx);
+         _batch->queued = false;
+         if (_batch->pending.empty())
+            return;
+         items = std::move(_batch->pending);
+         _batch->pending = std::move(_batch->spare);
+         _batch->spare.clear();
+         published = _batch->first_published;
+      }
+      _state->dispatch(items);
+      if (_state->mailboxes()) {
+         _state->read([&](const snapshot& s) {
+            for (const std::shared_ptr<const Data>& data : items)
+               post_to_mailboxes(_state, s, data, published);
          });
       }
+      items.clear();
+      std::lock_guard<std::mutex> g(_batch->mtx);
+      if (items.capacity() > _batch->spare.capacity())
+         _batch->spare = std::move(items);
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::schedule(const std::shared_ptr<state>& s, const subscriber_ptr& sub) {
+      mailbox& box = *sub->box;
+      auto run = [s, sub]() { run_mailbox(s, sub); };
+      if (box.pool) {
+         // discarded when the pool stops before running it
+         box.pool->post(box.priority, detail::make_discardable(std::move(run), [sub]() noexcept { abandon(*sub->box); }));
+      } else if (!app().post(box.priority, std::move(run))) {
+         // rejected by a priority at capacity, drop what is waiting rather than stall the mailbox
+         abandon(box);
+      }
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::abandon(mailbox& box) noexcept {
+      std::lock_guard<std::mutex> g(box.mtx);
+      box.items.clear();
+      box.scheduled = false;
    }
 
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::schedule_next(const std::shared_ptr<state>& s, const subscriber_ptr& sub) {
+      {
+         std::lock_guard<std::mutex> g(sub->box->mtx);
+         if (sub->box->items.empty() || !sub->connected.load(std::memory_order_relaxed)) {
+            sub->box->items.clear();
+            sub->box->scheduled = false;
+            return;
+         }
+      }
+      schedule(s, sub);
+   }
+
+   template<typename Data, typename DispatchPolicy>
+   void channel<Data,DispatchPolicy>::run_mailbox(const std::shared_ptr<state>& s, const subscriber_ptr& sub) {
+      mailbox& box = *sub->box;
+      std::shared_ptr<const Data> data;
+      std::chrono::steady_clock::time_point published;
+      {
+         std::lock_guard<std::mutex> g(box.mtx);
+         data = std::move(box.items.front().first);
+         published = box.items.front().second;
+         box.items.pop_front();
+      }
+      const int64_t lag = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - published).count();
+      box.delivered.fetch_add(1, std::memory_order_relaxed);
+      box.last_lag_ns.store(lag, std::memory_order_relaxed);
+      if (lag > box.max_lag_ns.load(std::memory_order_relaxed))
+         box.max_lag_ns.store(lag, std::memory_order_relaxed);
+      // one handler per item keeps higher priorities interleaved; post the next one even if the subscriber throws
+      try {
+         s->dispatch(sub, *data);
+      } catch (...) {
+         schedule_next(s, sub);
+         throw;
+      }
+      schedule_next(s, sub);
+   }
+
+#ifdef APPBASE_HAS_COROUTINES
+   inline void priority_awaitable::await_suspend( std::coroutine_handle<> h ) {
+      // nothing in the coroutine frame may be touched after post(), h can be resumed or destroyed right away
+      app().post( _priority, resumer( h ) );
+   }
+
+   inline void task::final_awaiter::await_suspend( std::coroutine_handle<promise_type> h ) noexcept {
+      std::exception_ptr e = std::move( h.promise().exception );
+      h.destroy();
+      if( e )
+         app().post( app().running_priority(), [e]() { std::rethrow_exception( e ); } );
+   }
+#endif
+
+   template<typename Item>
+   void aggregator<Item>::post( Item item ) {
+      std::unique_lock<std::mutex> g( my->mtx );
+      my->pending.push_back( std::move(item) );
+      if( my->pending.size() >= my->max_batch ) {
+         my->ready.push_back( std::move(my->pending) );
+         my->pending.clear();
+         if( !my->spare.empty() ) {
+            my->pending = std::move( my->spare.back() );
+            my->spare.pop_back();
+         }
+      }
+      if( my->queued )
+         return;
+      if( !my->ready.empty() || !my->max_delay.count() ) {
+         my->queued = true;
+         my->timer.cancel();
+         my->timer = timer_handle();
+         g.unlock();
+         schedule( my );
+      } else if( my->pending.size() == 1 ) {
+         // first item of a new partial batch, a weak reference so the state does not own itself through its timer
+         my->timer = app().post_after( my->max_delay, my->priority, [w = std::weak_ptr<state>( my )]() {
+            if( auto s = w.lock() )
+               dispatch( *s );
+         } );
+      }
+   }
+
+   template<typename Item>
+   void aggregator<Item>::schedule( const std::shared_ptr<state>& s ) {
+      if( !app().post( s->priority, [s]() { dispatch( *s ); } ) ) {
+         // priority at capacity, retried by the next post()
+         std::lock_guard<std::mutex> g( s->mtx );
+         s->queued = false;
+      }
+   }
+
+   template<typename Item>
+   void aggregator<Item>::dispatch( state& s ) {
+      {
+         std::lock_guard<std::mutex> g( s.mtx );
+         s.queued = false;
+         s.timer.cancel();
+         s.timer = timer_handle();
+         s.dispatching.swap( s.ready );
+         if( !s.pending.empty() ) {
+            s.dispatching.push_back( std::move(s.pending) );
+            s.pending.clear();
+         }
+      }
+      for( auto& batch : s.dispatching ) {
+         s.handler( batch );
+         batch.clear();
+      }
+      std::lock_guard<std::mutex> g( s.mtx );
+      for( auto& batch : s.dispatching ) {
+         if( s.pending.capacity() == 0 )
+            s.pending.swap( batch );
+         else
+            s.spare.push_back( std::move(batch) );
+      }
+      s.dispatching.clear();
+   }
 }
@@ -4,14 +4,33 @@
 #pragma push_macro("N")
 #undef N
 
+#include <appbase/priority_thread_pool.hpp>
+
 #include <boost/asio.hpp>
-#include <boost/signals2.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 namespace appbase {
 
    using erased_channel_ptr = std::unique_ptr<void, void(*)(void*)>;
 
+   /**
+    * How a channel delivers what is published, selected by its declaration
+    */
+   enum class channel_mode {
+      queued,    ///< one delivery per publish, see channel_decl
+      batched,   ///< publishes made while a delivery is pending join it, see batched_channel_decl
+      conflating ///< only the latest value is delivered and replayed to new subscribers, see conflating_channel_decl
+   };
+
    /**
     * A basic DispatchPolicy that will catch and drop any exceptions thrown
     * during the dispatch of messages on a channel
@@ -39,13 +58,302 @@ namespace appbase {
     * This removes the need to tightly couple different plugins in the application for the use-case of
     * sending data around
     *
-    * Data passed to a channel is *copied*, consider using a shared_ptr if the use-case allows it
+    * Data passed to a channel by const reference is *copied*. Publish an rvalue to move it instead, or a
+    * shared_ptr<const Data> to hand every subscriber a reference to one immutable payload without any copy.
+    *
+    * Subscribers are kept in an immutable list that subscribe() and unsubscribe() replace as a whole, so a
+    * dispatch takes no lock and calls the subscribers of the list current when it started. Replaced lists are
+    * reclaimed once no dispatch is reading them.
+    *
+    * By default all subscribers are called one after the other by a single handler posted at the priority of the
+    * publish. Subscribers given their own priority, optionally on a thread pool, instead receive the data through a
+    * mailbox of their own and run independently, so a slow subscriber only delays itself.
+    *
+    * A batched channel appends publishes to the pending delivery while it waits in the queue, so a burst of
+    * publishes costs one queue entry and one dispatch. Item subscribers are called for every item in order, batch
+    * subscribers (subscribe_batch) once with the whole batch.
+    *
+    * A conflating channel carries state rather than events: a publish replaces the value still waiting for its
+    * delivery, and a new subscriber is handed the last published value right away.
     *
     * @tparam Data - the type of data to publish
     */
    template<typename Data, typename DispatchPolicy>
    class channel final {
+      public:
+         /// what batch subscribers are called with, the published payloads in publish order
+         using batch_type = std::vector<std::shared_ptr<const Data>>;
+
+      private:
+         /// data published to a subscriber with its own priority, delivered in order one handler at a time
+         struct mailbox {
+            mailbox(int p, priority_thread_pool* tp)
+            :priority(p), pool(tp)
+            {}
+
+            const int                   priority;
+            priority_thread_pool* const pool;      ///< null for the application thread
+
+            std::mutex                                                                            mtx;
+            std::deque<std::pair<std::shared_ptr<const Data>, std::chrono::steady_clock::time_point>> items;
+            bool                                                                                  scheduled = false;
+
+            std::atomic<uint64_t>  delivered{0};
+            std::atomic<int64_t>   last_lag_ns{0};
+            std::atomic<int64_t>   max_lag_ns{0};
+         };
+
+         struct subscriber {
+            subscriber(std::function<void(const Data&)> cb, std::function<void(const batch_type&)> bcb,
+                       std::unique_ptr<mailbox> mb)
+            :callback(std::move(cb)), batch_callback(std::move(bcb)), box(std::move(mb))
+            {}
+
+            void operator()(const Data& data) const { callback(data); }
+            void operator()(const batch_type& batch) const { batch_callback(batch); }
+
+            const std::function<void(const Data&)>       callback;       ///< empty for batch subscribers
+            const std::function<void(const batch_type&)> batch_callback; ///< empty for the others
+            const std::unique_ptr<mailbox>               box;  ///< null for subscribers called by the shared dispatch
+            std::atomic<bool>                            connected{true};
+         };
+
+         using subscriber_ptr = std::shared_ptr<subscriber>;
+
+         /// immutable once published by state::replace
+         struct snapshot {
+            std::vector<subscriber_ptr>     subscribers;       ///< called by the shared dispatch
+            std::vector<subscriber_ptr>     batch_subscribers; ///< called by the shared dispatch with whole batches
+            std::vector<subscriber_ptr>     mailboxes;         ///< with a priority of their own
+            std::shared_ptr<DispatchPolicy> dispatcher;
+         };
+
+         /**
+          * Input iterator handed to the DispatchPolicy, dereferencing calls the subscriber with the data, an item or
+          * a batch. Subscribers that unsubscribed since the dispatch started are skipped.
+          */
+         template<typename Arg>
+         class slot_iterator {
+            public:
+               using iterator_category = std::input_iterator_tag;
+               using value_type = void;
+               using difference_type = std::ptrdiff_t;
+               using pointer = void;
+               using reference = void;
+
+               slot_iterator(const subscriber_ptr* pos, const subscriber_ptr* end, const Arg& data)
+               :_pos(pos), _end(end), _data(&data)
+               {
+                  skip_disconnected();
+               }
+
+               void operator*() const {
+                  const subscriber& s = **_pos;
+                  if (s.connected.load(std::memory_order_relaxed))
+                     s(*_data);
+               }
+
+               slot_iterator& operator++() {
+                  ++_pos;
+                  skip_disconnected();
+                  return *this;
+               }
+
+               slot_iterator operator++(int) {
+                  slot_iterator prev = *this;
+                  ++*this;
+                  return prev;
+               }
+
+               bool operator==(const slot_iterator& rhs) const { return _pos == rhs._pos; }
+               bool operator!=(const slot_iterator& rhs) const { return _pos != rhs._pos; }
+
+            private:
+               void skip_disconnected() {
+                  while (_pos != _end && !(*_pos)->connected.load(std::memory_order_relaxed))
+                     ++_pos;
+               }
+
+               const subscriber_ptr* _pos;
+               const subscriber_ptr* _end;
+               const Arg*            _data;
+         };
+
+         /**
+          * Subscribers and dispatcher, shared with the handles so they can outlive the channel.
+          *
+          * Writers serialize on a mutex, publish a new snapshot and retire the old one. Readers announce themselves
+          * in _readers before loading the snapshot, so once a writer sees no readers after swapping in a new
+          * snapshot, nothing can still be reading a retired one.
+          */
+         class state {
+            public:
+               state()
+               :_current(new snapshot{ {}, {}, {}, std::make_shared<DispatchPolicy>() })
+               {}
+
+               ~state() {
+                  delete _current.load();
+                  for (const snapshot* s : _retired)
+                     delete s;
+               }
+
+               subscriber_ptr add(subscriber_ptr sub) {
+                  std::lock_guard<std::mutex> g(_write_mtx);
+                  auto next = new snapshot(*_current.load(std::memory_order_relaxed));
+                  if (sub->box) {
+                     next->mailboxes.push_back(sub);
+                     _mailbox_count.fetch_add(1, std::memory_order_relaxed);
+                  } else if (sub->batch_callback) {
+                     next->batch_subscribers.push_back(sub);
+                     _batch_count.fetch_add(1, std::memory_order_relaxed);
+                  } else {
+                     next->subscribers.push_back(sub);
+                  }
+                  replace(next);
+                  _count.fetch_add(1, std::memory_order_relaxed);
+                  return sub;
+               }
+
+               void remove(const subscriber_ptr& sub) {
+                  if (!sub->connected.exchange(false))
+                     return;
+                  std::lock_guard<std::mutex> g(_write_mtx);
+                  const snapshot* cur = _current.load(std::memory_order_relaxed);
+                  auto next = new snapshot{ {}, {}, {}, cur->dispatcher };
+                  auto copy_except = [&sub](const std::vector<subscriber_ptr>& from, std::vector<subscriber_ptr>& to) {
+                     to.reserve(from.size());
+                     for (const auto& s : from)
+                        if (s != sub)
+                           to.push_back(s);
+                  };
+                  copy_except(cur->subscribers, next->subscribers);
+                  copy_except(cur->batch_subscribers, next->batch_subscribers);
+                  copy_except(cur->mailboxes, next->mailboxes);
+                  replace(next);
+                  _count.fetch_sub(1, std::memory_order_relaxed);
+                  if (sub->box)
+                     _mailbox_count.fetch_sub(1, std::memory_order_relaxed);
+                  else if (sub->batch_callback)
+                     _batch_count.fetch_sub(1, std::memory_order_relaxed);
+               }
+
+               void set_dispatcher(const DispatchPolicy& policy) {
+                  std::lock_guard<std::mutex> g(_write_mtx);
+                  const snapshot* cur = _current.load(std::memory_order_relaxed);
+                  replace(new snapshot{ cur->subscribers, cur->batch_subscribers, cur->mailboxes,
+                                        std::make_shared<DispatchPolicy>(policy) });
+               }
+
+               size_t size() const {
+                  return _count.load(std::memory_order_relaxed);
+               }
+
+               /// number of subscribers with a priority of their own
+               size_t mailboxes() const {
+                  return _mailbox_count.load(std::memory_order_relaxed);
+               }
+
+               /// number of subscribers taking whole batches
+               size_t batch_subscribers() const {
+                  return _batch_count.load(std::memory_order_relaxed);
+               }
+
+               /// call f with the current snapshot, which stays valid until f returns
+               template<typename F>
+               void read(F&& f) {
+                  struct reader_guard {
+                     std::atomic<uint32_t>& readers;
+                     ~reader_guard() { readers.fetch_sub(1); }
+                  };
+                  _readers.fetch_add(1);
+                  reader_guard g{_readers};
+                  f(*_current.load());
+               }
+
+               /**
+                * call the subscribers without a priority of their own through the DispatchPolicy. Publishes take the
+                * shared overload when there are batch subscribers, they get a copy only if they subscribed since.
+                */
+               void dispatch(const Data& data) {
+                  read([&data](const snapshot& s) {
+                     call(*s.dispatcher, s.subscribers, data);
+                     if (!s.batch_subscribers.empty())
+                        call(*s.dispatcher, s.batch_subscribers, batch_type{std::make_shared<const Data>(data)});
+                  });
+               }
+
+               /// call the subscribers without a priority of their own, batch subscribers with a batch sharing data
+               void dispatch(const std::shared_ptr<const Data>& data) {
+                  read([&data](const snapshot& s) {
+                     call(*s.dispatcher, s.subscribers, *data);
+                     if (!s.batch_subscribers.empty())
+                        call(*s.dispatcher, s.batch_subscribers, batch_type{data});
+                  });
+               }
+
+               /// call the subscribers without a priority of their own with every item, then the batch subscribers
+               void dispatch(const batch_type& batch) {
+                  read([&batch](const snapshot& s) {
+                     if (!s.subscribers.empty()) {
+                        for (const std::shared_ptr<const Data>& data : batch)
+                           call(*s.dispatcher, s.subscribers, *data);
+                     }
+                     call(*s.dispatcher, s.batch_subscribers, batch);
+                  });
+               }
+
+               /// call one subscriber through the DispatchPolicy
+               template<typename Arg>
+               void dispatch(const subscriber_ptr& sub, const Arg& data) {
+                  // hold the dispatcher rather than the snapshot, a slow subscriber must not hold up reclamation
+                  std::shared_ptr<DispatchPolicy> dispatcher;
+                  read([&dispatcher](const snapshot& s) { dispatcher = s.dispatcher; });
+                  call(*dispatcher, &sub, &sub + 1, data);
+               }
+
+            private:
+               template<typename Arg>
+               static void call(DispatchPolicy& dispatcher, const std::vector<subscriber_ptr>& subs, const Arg& data) {
+                  call(dispatcher, subs.data(), subs.data() + subs.size(), data);
+               }
+
+               template<typename Arg>
+               static void call(DispatchPolicy& dispatcher, const subscriber_ptr* first, const subscriber_ptr* last, const Arg& data) {
+                  dispatcher(slot_iterator<Arg>(first, last, data), slot_iterator<Arg>(last, last, data));
+               }
+
+               /// must hold _write_mtx
+               void replace(const snapshot* next) {
+                  _retired.push_back(_current.exchange(next));
+                  if (_readers.load() == 0) {
+                     for (const snapshot* s : _retired)
+                        delete s;
+                     _retired.clear();
+                  }
+               }
+
+               std::atomic<const snapshot*> _current;
+               std::atomic<uint32_t>        _readers{0};
+               std::atomic<size_t>          _count{0};
+               std::atomic<size_t>          _mailbox_count{0};
+               std::atomic<size_t>          _batch_count{0};
+               std::mutex                   _write_mtx;
+               std::vector<const snapshot*> _retired; ///< replaced snapshots a dispatch may still be reading
+         };
+
       public:
+         /**
+          * Delivery statistics of a subscriber with a priority of its own, all zero for other subscribers.
+          * Lag is the time from publish until the subscriber is called.
+          */
+         struct subscriber_stats {
+            size_t                   pending = 0;   ///< published and not yet delivered
+            uint64_t                 delivered = 0;
+            std::chrono::nanoseconds last_lag{0};
+            std::chrono::nanoseconds max_lag{0};
+         };
+
          /**
           * Type that represents an active subscription to a channel allowing
           * for ownership via RAII and also explicit unsubscribe actions
@@ -61,9 +369,32 @@ namespace appbase {
                 * of this object expires
                 */
                void unsubscribe() {
-                  if (_handle.connected()) {
-                     _handle.disconnect();
+                  auto state = _state.lock();
+                  auto sub = _subscriber.lock();
+                  if (state && sub) {
+                     state->remove(sub);
                   }
+                  _state.reset();
+                  _subscriber.reset();
+               }
+
+               /**
+                * Delivery statistics of this subscription, safe to call from any thread
+                */
+               subscriber_stats stats() const {
+                  subscriber_stats st;
+                  auto sub = _subscriber.lock();
+                  if (!sub || !sub->box)
+                     return st;
+                  mailbox& box = *sub->box;
+                  {
+                     std::lock_guard<std::mutex> g(box.mtx);
+                     st.pending = box.items.size();
+                  }
+                  st.delivered = box.delivered.load(std::memory_order_relaxed);
+                  st.last_lag = std::chrono::nanoseconds(box.last_lag_ns.load(std::memory_order_relaxed));
+                  st.max_lag = std::chrono::nanoseconds(box.max_lag_ns.load(std::memory_order_relaxed));
+                  return st;
                }
 
                // This handle can be constructed and moved
@@ -76,17 +407,17 @@ namespace appbase {
                handle& operator= (const handle& ) = delete;
 
             private:
-               using handle_type = boost::signals2::connection;
-               handle_type _handle;
+               std::weak_ptr<state>      _state;
+               std::weak_ptr<subscriber> _subscriber;
 
                /**
-                * Construct a handle from an internal represenation of a handle
-                * In this case a boost::signals2::connection
+                * Construct a handle for a subscriber of a channel
                 *
-                * @param _handle - the boost::signals2::connection to wrap
+                * @param s - the shared state of the channel
+                * @param sub - the subscriber to remove on unsubscribe
                 */
-               handle(handle_type&& _handle)
-               :_handle(std::move(_handle))
+               handle(const std::shared_ptr<state>& s, const subscriber_ptr& sub)
+               :_state(s), _subscriber(sub)
                {}
 
                friend class channel;
@@ -99,6 +430,21 @@ namespace appbase {
           */
          void publish(int priority, const Data& data);
 
+         /**
+          * Publish data to a channel, moving it into the queued dispatch instead of copying it.
+          * @param priority - the priority to use for post
+          * @param data - the data to publish, left unspecified if there are subscribers
+          */
+         void publish(int priority, Data&& data);
+
+         /**
+          * Publish an immutable payload to a channel. Subscribers receive a reference to the shared payload, which
+          * is released once the dispatch has run. Use for large payloads, e.g. blocks, that are also kept elsewhere.
+          * @param priority - the priority to use for post
+          * @param data - the payload to publish, must not be null
+          */
+         void publish(int priority, std::shared_ptr<const Data> data);
+
          /**
           * subscribe to data on a channel
           * @tparam Callback the type of the callback (functor|lambda)
@@ -107,7 +453,47 @@ namespace appbase {
           */
          template<typename Callback>
          handle subscribe(Callback cb) {
-            return handle(_signal.connect(cb));
+            return add(std::make_shared<subscriber>(std::move(cb), nullptr, nullptr));
+         }
+
+         /**
+          * subscribe to data on a channel, called by handlers of its own posted at priority instead of by the
+          * handler posted at the priority of the publish. Data is delivered in publish order.
+          * @tparam Callback the type of the callback (functor|lambda)
+          * @param cb the callback
+          * @param priority the priority to call cb at on the application thread
+          * @return handle to the subscription
+          */
+         template<typename Callback>
+         handle subscribe(Callback cb, int priority) {
+            return add(std::make_shared<subscriber>(std::move(cb), nullptr, std::make_unique<mailbox>(priority, nullptr)));
+         }
+
+         /**
+          * subscribe to data on a channel, called on pool at priority. Data is delivered in publish order, calls
+          * of cb never overlap. The DispatchPolicy is called from the pool threads and must be thread safe.
+          * @tparam Callback the type of the callback (functor|lambda)
+          * @param cb the callback
+          * @param pool the pool to call cb on, e.g. app().get_worker_pool(); must outlive the subscription
+          * @param priority the priority to call cb at on pool
+          * @return handle to the subscription
+          */
+         template<typename Callback>
+         handle subscribe(Callback cb, priority_thread_pool& pool, int priority) {
+            return add(std::make_shared<subscriber>(std::move(cb), nullptr, std::make_unique<mailbox>(priority, &pool)));
+         }
+
+         /**
+          * subscribe to batches of data on a channel, called with everything a delivery of a batched channel carries,
+          * in publish order, after the item subscribers. On other channels every publish is a batch of one.
+          * @tparam Callback the type of the callback (functor|lambda) taking a const batch_type&, which shares the
+          * published payloads rather than copying them
+          * @param cb the callback
+          * @return handle to the subscription
+          */
+         template<typename Callback>
+         handle subscribe_batch(Callback cb) {
+            return add(std::make_shared<subscriber>(nullptr, std::move(cb), nullptr));
          }
 
          /**
@@ -120,19 +506,21 @@ namespace appbase {
           */
          auto set_dispatcher(const DispatchPolicy& policy ) -> std::enable_if_t<std::is_copy_constructible<DispatchPolicy>::value,void>
          {
-            _signal.set_combiner(policy);
+            _state->set_dispatcher(policy);
          }
 
          /**
           * Returns whether or not there are subscribers
           */
          bool has_subscribers() {
-            auto connections = _signal.num_slots();
-            return connections > 0;
+            return _state->size() > 0;
          }
 
       private:
-         channel()
+         explicit channel(channel_mode mode)
+         :_state(std::make_shared<state>())
+         ,_batch(mode == channel_mode::batched ? std::make_unique<batch>() : nullptr)
+         ,_latest(mode == channel_mode::conflating ? std::make_unique<latest_value>() : nullptr)
          {
          }
 
@@ -163,12 +551,66 @@ namespace appbase {
           * Construct a unique_ptr for the type erased method poiner
           * @return
           */
-         static erased_channel_ptr make_unique()
+         static erased_channel_ptr make_unique(channel_mode mode)
          {
-            return erased_channel_ptr(new channel(), &deleter);
+            return erased_channel_ptr(new channel(mode), &deleter);
          }
 
-         boost::signals2::signal<void(const Data&), DispatchPolicy> _signal;
+         /// publishes of a batched channel waiting for their delivery
+         struct batch {
+            std::mutex                            mtx;
+            batch_type                            pending;
+            batch_type                            spare;           ///< delivered batch, reused to keep its capacity
+            std::chrono::steady_clock::time_point first_published; ///< of the pending batch
+            int                                   queued_priority = 0;
+            bool                                  queued = false;  ///< a delivery is in the priority queue
+         };
+
+         /// last value published to a conflating channel
+         struct latest_value {
+            std::mutex                            mtx;
+            std::shared_ptr<const Data>           value;
+            std::chrono::steady_clock::time_point published;
+            int                                   priority = 0;
+            bool                                  queued = false; ///< a delivery is in the priority queue
+         };
+
+         /// add sub, replaying the latest value to it on a conflating channel
+         handle add(subscriber_ptr sub);
+
+         /// post data to the subscribers with a priority of their own and, at priority, to the others
+         void deliver(int priority, std::shared_ptr<const Data> data);
+
+         static void post_to_mailboxes(const std::shared_ptr<state>& s, const snapshot& snap, const std::shared_ptr<const Data>& data,
+                                       std::chrono::steady_clock::time_point published, bool conflate = false);
+
+         /// add data to the mailbox of sub, replacing what is waiting there if conflate
+         static void post_to_mailbox(const std::shared_ptr<state>& s, const subscriber_ptr& sub, const std::shared_ptr<const Data>& data,
+                                     std::chrono::steady_clock::time_point published, bool conflate);
+
+         /// replace the latest value of a conflating channel, queueing a delivery unless one is queued
+         void store(int priority, std::shared_ptr<const Data> data);
+
+         void deliver_latest();
+
+         /// hand the latest value of a conflating channel to a new subscriber
+         void replay(const subscriber_ptr& sub);
+
+         /// add data to the pending batch, queueing a delivery at priority unless one at least as high is queued
+         void append(int priority, std::shared_ptr<const Data> data);
+
+         void deliver_batch();
+
+         static void schedule(const std::shared_ptr<state>& s, const subscriber_ptr& sub);
+         static void run_mailbox(const std::shared_ptr<state>& s, const subscriber_ptr& sub);
+         /// schedule the next item of a mailbox that just delivered one, or mark it idle
+         static void schedule_next(const std::shared_ptr<state>& s, const subscriber_ptr& sub);
+         /// drop what is waiting in a mailbox whose run will not happen, so the next publish schedules it again
+         static void abandon(mailbox& box) noexcept;
+
+         std::shared_ptr<state> _state;
+         std::unique_ptr<batch> _batch; ///< null unless batched
+         std::unique_ptr<latest_value> _latest; ///< null unless conflating
 
          friend class appbase::application;
    };
@@ -183,11 +625,51 @@ namespace appbase {
    struct channel_decl {
       using channel_type = channel<Data, DispatchPolicy>;
       using tag_type = Tag;
+      static constexpr channel_mode mode = channel_mode::queued;
+   };
+
+   /**
+    * Declares a batched channel, see channel. Publishes may come from any thread, those made while a delivery is
+    * queued are added to it. A publish at a higher priority than the queued delivery queues another one at its
+    * priority, whichever runs first delivers everything pending.
+    *
+    * @tparam Tag - API specific discriminator used to distinguish between otherwise identical data types
+    * @tparam Data - the typ of the Data the channel carries
+    * @tparam DispatchPolicy - The dispatch policy to use for this channel (defaults to @ref drop_exceptions)
+    */
+   template< typename Tag, typename Data, typename DispatchPolicy = drop_exceptions >
+   struct batched_channel_decl {
+      using channel_type = channel<Data, DispatchPolicy>;
+      using tag_type = Tag;
+      static constexpr channel_mode mode = channel_mode::batched;
+   };
+
+   /**
+    * Declares a conflating channel, see channel. At most one delivery is queued: publishes made while it waits
+    * replace its value, so subscribers only see the latest one. The value is kept after delivery and handed to
+    * subscribers that subscribe later, at the priority of the publish. A subscriber whose replay is overtaken by
+    * a new publish may receive the latest value twice, never an older value after a newer one.
+    *
+    * @tparam Tag - API specific discriminator used to distinguish between otherwise identical data types
+    * @tparam Data - the typ of the Data the channel carries
+    * @tparam DispatchPolicy - The dispatch policy to use for this channel (defaults to @ref drop_exceptions)
+    */
+   template< typename Tag, typename Data, typename DispatchPolicy = drop_exceptions >
+   struct conflating_channel_decl {
+      using channel_type = channel<Data, DispatchPolicy>;
+      using tag_type = Tag;
+      static constexpr channel_mode mode = channel_mode::conflating;
    };
 
    template <typename...Ts>
    std::true_type is_channel_decl_impl(const channel_decl<Ts...>*);
 
+   template <typename...Ts>
+   std::true_type is_channel_decl_impl(const batched_channel_decl<Ts...>*);
+
+   template <typename...Ts>
+   std::true_type is_channel_decl_impl(const conflating_channel_decl<Ts...>*);
+
    std::false_type is_channel_decl_impl(...);
 
    template <typename T>
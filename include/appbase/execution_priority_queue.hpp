@@ -1,7 +1,20 @@
 #pragma once
+#include <appbase/small_handler.hpp>
 #include <boost/asio.hpp>
 
-#include <queue>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Set to 0 to compile out per priority statistics of execution_priority_queue, see execution_priority_queue::stats()
+#ifndef APPBASE_QUEUE_STATS
+#define APPBASE_QUEUE_STATS 1
+#endif
 
 namespace appbase {
 // adapted from: https://www.boost.org/doc/libs/1_69_0/doc/html/boost_asio/example/cpp11/invocation/prioritised_handlers.cpp
@@ -16,37 +29,356 @@ struct priority {
    static constexpr int highest     = std::numeric_limits<int>::max();
 };
 
+namespace detail {
+   struct cancel_state
+   {
+      enum : uint8_t { pending, started, cancelled };
+      std::atomic<uint8_t>  state{pending};
+      // owning queue's count of cancelled but still queued handlers, shared so a token may outlive the queue
+      std::shared_ptr<std::atomic<size_t>> tombstones;
+   };
+}
+
+/**
+ * Allows a handler added to execution_priority_queue to be revoked before it starts. Cancelled handlers stay queued as
+ * tombstones and are skipped when reached, copies of a token refer to the same handler.
+ */
+class cancellation_token
+{
+public:
+   cancellation_token() = default;
+
+   /**
+    * Safe to call from any thread.
+    * @return true if the handler had not started and now never will
+    */
+   bool cancel()
+   {
+      uint8_t expected = detail::cancel_state::pending;
+      if( !state_ || !state_->state.compare_exchange_strong(expected, detail::cancel_state::cancelled) )
+         return false;
+      state_->tombstones->fetch_add(1, std::memory_order_relaxed);
+      return true;
+   }
+
+   bool cancelled() const { return state_ && state_->state == detail::cancel_state::cancelled; }
+
+private:
+   explicit cancellation_token(std::shared_ptr<detail::cancel_state> s) : state_(std::move(s)) {}
+
+   std::shared_ptr<detail::cancel_state> state_;
+
+   friend class execution_priority_queue;
+};
+
 class execution_priority_queue : public boost::asio::execution_context
 {
 public:
 
+   ~execution_priority_queue()
+   {
+      // handlers never executed are destroyed here, remote nodes must go back to the pool to be deleted
+      const auto release_ring = [&](handler_ring& ring) {
+         while( !ring.empty() )
+            pool_.release(ring.pop_front());
+      };
+      for( auto& ring : levels_ )
+         release_ring(ring);
+      for( auto& r : other_levels_ )
+         release_ring(r.second);
+      pool_.release_list(incoming_.exchange(nullptr, std::memory_order_acquire));
+   }
+
+   /**
+    * Never blocks, a full priority with overflow_policy::block accepts the handler over its capacity.
+    * @param token optional, from make_cancellation_token(), allows the handler to be cancelled
+    * @return false if the handler was rejected because its priority is at capacity, see set_capacity()
+    */
    template <typename Function>
-   void add(int priority, Function function)
+   bool add(int priority, Function function, const cancellation_token& token = {})
    {
-      std::unique_ptr<queued_handler_base> handler(new queued_handler<Function>(priority, --order_, std::move(function)));
+      const admission a = admit(priority, token, false);
+      if( a == admission::rejected )
+         return false;
+      queued_handler* h = pool_.allocate(priority, std::move(function));
+      h->bounded_ = a == admission::bounded;
+      h->cancel_ = token.state_;
+      stamp(h);
+      push(h);
+      return true;
+   }
 
-      handlers_.push(std::move(handler));
+   /**
+    * @return a token to pass to one add() or add_concurrent() call
+    */
+   cancellation_token make_cancellation_token()
+   {
+      auto state = std::make_shared<detail::cancel_state>();
+      state->tombstones = tombstones_;
+      return cancellation_token(std::move(state));
+   }
+
+   enum class add_result {
+      rejected,     ///< priority is at capacity, the handler was destroyed
+      queued,       ///< a drain_incoming() is already due and will pick the handler up
+      queued_first  ///< incoming stack was empty, the caller must arrange a call to drain_incoming()
+   };
+
+   /**
+    * Thread safe add(). The handler is pushed onto a lock-free incoming stack and only becomes visible to
+    * execute_highest() after drain_incoming() has been called on the executing thread. Later adds are picked up by
+    * the same drain, so wakeups are coalesced.
+    *
+    * Blocks while the priority is at capacity with overflow_policy::block and blocking is allowed, so it must not be
+    * called from the executing thread.
+    */
+   template <typename Function>
+   add_result add_concurrent(int priority, Function function, const cancellation_token& token = {})
+   {
+      const admission a = admit(priority, token, true);
+      if( a == admission::rejected )
+         return add_result::rejected;
+      queued_handler* h = pool_.allocate_remote(priority, std::move(function));
+      h->bounded_ = a == admission::bounded;
+      h->cancel_ = token.state_;
+      stamp(h);
+      return push_incoming(h);
+   }
+
+   /**
+    * add_concurrent() for handlers that must not be lost, e.g. ones reporting the outcome of other work. They are
+    * not counted against the capacity of priority, so they are never rejected, dropped or blocked.
+    * Safe to call from any thread, including the executing one.
+    */
+   template <typename Function>
+   add_result add_concurrent_unbounded(int priority, Function function)
+   {
+      queued_handler* h = pool_.allocate_remote(priority, std::move(function));
+      stamp(h);
+      return push_incoming(h);
+   }
+
+   /**
+    * Move everything added by add_concurrent() into the queue in FIFO order.
+    * Must be called from the executing thread.
+    * @return number of handlers moved
+    */
+   size_t drain_incoming()
+   {
+      queued_handler* lifo = incoming_.exchange(nullptr, std::memory_order_acquire);
+      queued_handler* fifo = nullptr;
+      while( lifo ) {
+         queued_handler* next = lifo->next_;
+         lifo->next_ = fifo;
+         fifo = lifo;
+         lifo = next;
+      }
+      size_t n = 0;
+      while( fifo ) {
+         queued_handler* next = fifo->next_;
+         fifo->next_ = nullptr;
+         push(fifo);
+         fifo = next;
+         ++n;
+      }
+      return n;
    }
 
    void execute_all()
    {
-      while (!handlers_.empty()) {
-         handlers_.top()->execute();
-         handlers_.pop();
+      while (size_ > 0) {
+         execute(pop());
       }
    }
 
    bool execute_highest()
    {
-      if( !handlers_.empty() ) {
-         handlers_.top()->execute();
-         handlers_.pop();
+      maybe_compact();
+      // cancelled handlers are skipped without using up this call
+      while( size_ > 0 && !execute(pop()) ) {}
+
+      return size_ > 0;
+   }
+
+   size_t size() { return size_; }
+
+   /// Priority of the handler being executed, priority::medium outside of one. Call from the executing thread.
+   int current_priority() const { return running_priority_; }
+
+   /// Distribution of durations in power of two nanosecond buckets
+   struct latency_stats
+   {
+      static constexpr size_t num_buckets = 40;
+
+      uint64_t                 count = 0;
+      std::chrono::nanoseconds total{0};
+      std::chrono::nanoseconds max{0};
+      uint64_t                 buckets[num_buckets] = {}; ///< buckets[n] counts durations in [2^n, 2^(n+1)) ns
+
+      void record(std::chrono::nanoseconds d)
+      {
+         ++count;
+         total += d;
+         if( d > max )
+            max = d;
+         uint64_t ns = d.count() > 0 ? static_cast<uint64_t>(d.count()) : 1;
+#if defined(__GNUC__) || defined(__clang__)
+         const size_t bucket = 63 - __builtin_clzll(ns);
+#else
+         size_t bucket = 0;
+         while( ns >>= 1 ) ++bucket;
+#endif
+         ++buckets[bucket < num_buckets ? bucket : num_buckets - 1];
       }
 
-      return !handlers_.empty();
+      std::chrono::nanoseconds average() const { return count ? total / static_cast<int64_t>(count) : std::chrono::nanoseconds{0}; }
+
+      /// @return upper bound of the bucket containing the p-th percentile, 0 < p <= 1
+      std::chrono::nanoseconds percentile(double p) const
+      {
+         const uint64_t rank = static_cast<uint64_t>(p * count + 0.5);
+         uint64_t seen = 0;
+         for( size_t n = 0; n < num_buckets; ++n ) {
+            seen += buckets[n];
+            if( seen >= rank && seen > 0 )
+               return std::min(std::chrono::nanoseconds(int64_t(2) << n), max);
+         }
+         return max;
+      }
+   };
+
+   struct priority_stats
+   {
+      uint64_t      enqueued = 0; ///< handlers that entered the queue, add_concurrent() ones once drained
+      uint64_t      dequeued = 0; ///< handlers that started executing
+      size_t        depth = 0;    ///< handlers currently queued
+      latency_stats wait;         ///< from add() until the handler started
+      latency_stats run;          ///< from start until the handler returned
+   };
+
+   /**
+    * Per priority counters, only collected when APPBASE_QUEUE_STATS is non-zero, otherwise only depth is filled in.
+    * Costs one clock read when a handler is added and two when it runs. Not thread safe, call from the executing
+    * thread.
+    *
+    * @param priority one of the appbase::priority constants, all other priorities share a single entry
+    * @return statistics of handlers at priority since construction or reset_stats()
+    */
+   priority_stats stats(int priority) const
+   {
+      const size_t level = level_of(priority);
+      priority_stats s = stats_[level];
+      if( level < num_levels ) {
+         s.depth = levels_[level].size();
+      } else {
+         s.depth = 0;
+         for( const auto& r : other_levels_ )
+            s.depth += r.second.size();
+      }
+      return s;
+   }
+
+   void reset_stats()
+   {
+      for( auto& s : stats_ )
+         s = priority_stats{};
+      aged_count_ = 0;
+   }
+
+   /// Number of cancelled handlers skipped or compacted away since construction
+   uint64_t cancelled_count() const { return cancelled_count_; }
+
+   enum class scheduling_mode {
+      strict, ///< always execute the highest priority handler, lower priorities can starve
+      aging   ///< handlers waiting longer than a limit run first, oldest first, regardless of priority
+   };
+
+   /**
+    * Select how the next handler is chosen. Strict priority is the default.
+    *
+    * In aging mode a handler that has waited longer than starvation_limit is promoted ahead of all
+    * higher priority work. The wait of any handler is then bounded by starvation_limit plus the time to run the
+    * handlers that became overdue before it, which the wait max of stats() makes observable.
+    */
+   void set_scheduling_mode(scheduling_mode mode, std::chrono::microseconds starvation_limit = {})
+   {
+      starvation_limit_ = starvation_limit;
+      mode_ = mode;
+   }
+
+   scheduling_mode get_scheduling_mode() const { return mode_; }
+
+   /// Number of handlers executed ahead of higher priority work by aging since construction or reset_stats()
+   uint64_t aged_count() const { return aged_count_; }
+
+   enum class overflow_policy {
+      reject,      ///< add() returns false, add_concurrent() returns add_result::rejected
+      drop_oldest, ///< the handler is queued and the oldest queued handler counted against the same bound is dropped
+      block        ///< add_concurrent() waits until there is room, add() never blocks and queues over capacity
+   };
+
+   /**
+    * Bound the number of handlers of a priority that are queued or waiting on the incoming stack. Handlers added
+    * before the capacity was set are not counted against it. A capacity of 0 removes the bound.
+    *
+    * drop_oldest is applied as handlers enter the queue, so add_concurrent() handlers not yet drained can exceed
+    * the capacity until the next drain_incoming(). A handler rejected or dropped with a cancellation token reports
+    * cancelled(). Threads blocked by overflow_policy::block are not counted as pending while they wait, they take a
+    * slot once one is free.
+    *
+    * @param priority one of the appbase::priority constants, all other priorities share a single bound and drop the
+    *                 oldest handler among them, whatever its priority
+    */
+   void set_capacity(int priority, size_t capacity, overflow_policy policy)
+   {
+      level_limit& l = limits_[level_of(priority)];
+      l.policy = policy;
+      l.capacity = capacity;
+      std::lock_guard<std::mutex> g(block_mtx_);
+      block_cv_.notify_all();
+   }
+
+   /**
+    * Called with the priority of a handler that is rejected, dropped, or about to block. Runs on the thread that
+    * added the handler, except for drops which run on the executing thread, so it must be thread safe. Set before
+    * handlers are added.
+    */
+   void set_overflow_handler(std::function<void(int priority, overflow_policy)> handler)
+   {
+      overflow_handler_ = std::move(handler);
+   }
+
+   /**
+    * Blocking of add_concurrent() by overflow_policy::block is off by default. The executing thread turns it on once
+    * it drains the queue and must turn it off, which wakes all blocked threads, before it stops doing so.
+    */
+   void allow_blocking(bool allow)
+   {
+      {
+         std::lock_guard<std::mutex> g(block_mtx_);
+         blocking_allowed_ = allow;
+      }
+      block_cv_.notify_all();
    }
 
-   size_t size() { return handlers_.size(); }
+   struct overflow_stats
+   {
+      size_t   capacity = 0; ///< 0 when unbounded
+      size_t   pending = 0;  ///< handlers currently counted against capacity
+      uint64_t rejected = 0;
+      uint64_t dropped = 0;
+      uint64_t blocked = 0;  ///< add_concurrent() calls that had to wait for room
+   };
+
+   /**
+    * Thread safe, producers can compare pending to capacity to throttle before the limit is hit.
+    * @param priority one of the appbase::priority constants, all other priorities share a single entry
+    */
+   overflow_stats overflow(int priority) const
+   {
+      const level_limit& l = limits_[level_of(priority)];
+      return overflow_stats{ l.capacity, l.pending, l.rejected, l.dropped, l.blocked };
+   }
 
    class executor
    {
@@ -105,64 +437,570 @@ public:
    }
 
 private:
-   class queued_handler_base
+   struct queued_handler
+   {
+      int            priority_ = 0;
+      bool           remote_ = false;  // allocated by add_concurrent() outside of the slabs
+      bool           bounded_ = false; // counted against the capacity of its priority
+      std::chrono::steady_clock::time_point enqueued_;
+      std::shared_ptr<detail::cancel_state> cancel_;
+      queued_handler* next_ = nullptr; // free list or incoming stack link while not queued
+      small_handler  function_;
+   };
+
+   /**
+    * Recycles queued_handler nodes so that queueing a handler whose function fits in small_handler's
+    * inline buffer does not touch the global allocator. Nodes are carved out of slabs which are only
+    * returned when the queue is destroyed.
+    *
+    * Nodes for add_concurrent() are taken from a per thread cache instead. Once executed they are pushed onto
+    * a lock-free returned stack from which producer threads refill their cache.
+    */
+   class handler_pool
    {
    public:
-      queued_handler_base( int p, size_t order )
-            : priority_( p )
-            , order_( order )
+      ~handler_pool()
       {
+         remote_cache::delete_list(returned_.exchange(nullptr, std::memory_order_acquire));
       }
 
-      virtual ~queued_handler_base() = default;
+      template <typename Function>
+      queued_handler* allocate(int priority, Function&& function)
+      {
+         if( !free_ )
+            grow();
+         queued_handler* h = free_;
+         h->function_ = small_handler(std::forward<Function>(function));
+         free_ = h->next_;
+         h->next_ = nullptr;
+         h->priority_ = priority;
+         return h;
+      }
 
-      virtual void execute() = 0;
+      template <typename Function>
+      queued_handler* allocate_remote(int priority, Function&& function)
+      {
+         remote_cache& cache = remote_cache::local();
+         if( !cache.head_ )
+            cache.head_ = returned_.exchange(nullptr, std::memory_order_acquire);
+         queued_handler* h = cache.head_;
+         if( h ) {
+            h->function_ = small_handler(std::forward<Function>(function));
+            cache.head_ = h->next_;
+         } else {
+            std::unique_ptr<queued_handler> n(new queued_handler);
+            n->remote_ = true;
+            n->function_ = small_handler(std::forward<Function>(function));
+            h = n.release();
+         }
+         h->next_ = nullptr;
+         h->priority_ = priority;
+         return h;
+      }
 
-      int priority() const { return priority_; }
-      // C++20
-      // friend std::weak_ordering operator<=>(const queued_handler_base&,
-      //                                       const queued_handler_base&) noexcept = default;
-      friend bool operator<(const queued_handler_base& a,
-                            const queued_handler_base& b) noexcept
+      void release(queued_handler* h) noexcept
       {
-         return std::tie( a.priority_, a.order_ ) < std::tie( b.priority_, b.order_ );
+         h->function_.reset();
+         h->cancel_.reset();
+         if( h->remote_ ) {
+            queued_handler* head = returned_.load(std::memory_order_relaxed);
+            do {
+               h->next_ = head;
+            } while( !returned_.compare_exchange_weak(head, h, std::memory_order_release, std::memory_order_relaxed) );
+         } else {
+            h->next_ = free_;
+            free_ = h;
+         }
+      }
+
+      /// release a next_ linked list of nodes that were never queued
+      void release_list(queued_handler* h) noexcept
+      {
+         while( h ) {
+            queued_handler* next = h->next_;
+            release(h);
+            h = next;
+         }
       }
 
    private:
-      int priority_;
-      size_t order_;
+      struct remote_cache
+      {
+         ~remote_cache() { delete_list(head_); }
+
+         static remote_cache& local()
+         {
+            static thread_local remote_cache cache;
+            return cache;
+         }
+
+         static void delete_list(queued_handler* h)
+         {
+            while( h ) {
+               queued_handler* next = h->next_;
+               delete h;
+               h = next;
+            }
+         }
+
+         queued_handler* head_ = nullptr;
+      };
+
+      static constexpr size_t slab_size = 256;
+
+      void grow()
+      {
+         slabs_.emplace_back(new queued_handler[slab_size]);
+         queued_handler* slab = slabs_.back().get();
+         for( size_t i = 0; i < slab_size; ++i ) {
+            slab[i].next_ = free_;
+            free_ = &slab[i];
+         }
+      }
+
+      std::vector<std::unique_ptr<queued_handler[]>> slabs_;
+      queued_handler*                                free_ = nullptr;
+      std::atomic<queued_handler*>                   returned_{nullptr};
    };
 
-   template <typename Function>
-   class queued_handler : public queued_handler_base
+   /// FIFO of handlers of a single priority, a power of two sized ring buffer that only grows
+   class handler_ring
    {
    public:
-      queued_handler(int p, size_t order, Function f)
-            : queued_handler_base( p, order )
-            , function_( std::move(f) )
+      bool   empty() const { return size_ == 0; }
+      size_t size() const  { return size_; }
+
+      queued_handler* front() const { return buf_[head_]; }
+      queued_handler* at(size_t pos) const { return buf_[(head_ + pos) & (buf_.size() - 1)]; }
+
+      void push_back(queued_handler* h)
+      {
+         if( size_ == buf_.size() )
+            grow();
+         buf_[(head_ + size_) & (buf_.size() - 1)] = h;
+         ++size_;
+      }
+
+      queued_handler* pop_front()
       {
+         queued_handler* h = buf_[head_];
+         head_ = (head_ + 1) & (buf_.size() - 1);
+         --size_;
+         return h;
       }
 
-      void execute() override
+      /// @return position of the first handler counted against a capacity, size() if there is none
+      size_t find_bounded() const
       {
-         function_();
+         size_t pos = 0;
+         while( pos < size_ && !at(pos)->bounded_ )
+            ++pos;
+         return pos;
+      }
+
+      /// remove the handler at pos, moving the ones ahead of it back so the order is kept
+      queued_handler* erase(size_t pos)
+      {
+         queued_handler* h = at(pos);
+         for( ; pos > 0; --pos )
+            slot(pos) = slot(pos - 1);
+         pop_front();
+         return h;
       }
 
    private:
-      Function function_;
+      queued_handler*& slot(size_t pos) { return buf_[(head_ + pos) & (buf_.size() - 1)]; }
+
+      void grow()
+      {
+         std::vector<queued_handler*> buf(buf_.empty() ? 64 : buf_.size() * 2);
+         for( size_t i = 0; i < size_; ++i )
+            buf[i] = buf_[(head_ + i) & (buf_.size() - 1)];
+         buf_.swap(buf);
+         head_ = 0;
+      }
+
+      std::vector<queued_handler*> buf_;
+      size_t                       head_ = 0;
+      size_t                       size_ = 0;
    };
 
-   struct deref_less
+   using ring_map = std::map<int, handler_ring, std::greater<int>>;
+
+   /// rings for the appbase::priority constants, indexed lowest to highest
+   static constexpr size_t num_levels = 7;
+
+   static constexpr int level_priority(size_t level)
    {
-      template<typename Pointer>
-      bool operator()(const Pointer& a, const Pointer& b) noexcept(noexcept(*a < *b))
-      {
-         return *a < *b;
+      constexpr int priorities[num_levels] = { priority::lowest, priority::low, priority::medium_low, priority::medium,
+                                               priority::medium_high, priority::high, priority::highest };
+      return priorities[level];
+   }
+
+   /// @return index into levels_ or num_levels if priority is not one of the appbase::priority constants
+   static size_t level_of(int p)
+   {
+      switch( p ) {
+         case priority::lowest:      return 0;
+         case priority::low:         return 1;
+         case priority::medium_low:  return 2;
+         case priority::medium:      return 3;
+         case priority::medium_high: return 4;
+         case priority::high:        return 5;
+         case priority::highest:     return 6;
+         default:                    return num_levels;
+      }
+   }
+
+   void push(queued_handler* h)
+   {
+      const size_t level = level_of(h->priority_);
+      if( level < num_levels ) {
+         levels_[level].push_back(h);
+         nonempty_levels_ |= 1u << level;
+      } else {
+         auto itr = other_levels_.find(h->priority_);
+         if( itr == other_levels_.end() ) {
+            if( spare_rings_.empty() ) {
+               itr = other_levels_.emplace(h->priority_, handler_ring()).first;
+            } else {
+               // reuse a previously emptied map node (and its ring capacity) to avoid allocating
+               spare_rings_.back().key() = h->priority_;
+               itr = other_levels_.insert(std::move(spare_rings_.back())).position;
+               spare_rings_.pop_back();
+            }
+         }
+         itr->second.push_back(h);
       }
+      ++size_;
+#if APPBASE_QUEUE_STATS
+      ++stats_[level].enqueued;
+#endif
+      if( h->bounded_ && limits_[level].policy.load(std::memory_order_relaxed) == overflow_policy::drop_oldest )
+         drop_oldest(level);
+   }
+
+   add_result push_incoming(queued_handler* h)
+   {
+      queued_handler* head = incoming_.load(std::memory_order_relaxed);
+      do {
+         h->next_ = head;
+      } while( !incoming_.compare_exchange_weak(head, h, std::memory_order_release, std::memory_order_relaxed) );
+      return head == nullptr ? add_result::queued_first : add_result::queued;
+   }
+
+   enum class admission { unbounded, bounded, rejected };
+
+   struct level_limit
+   {
+      std::atomic<size_t>          capacity{0};
+      std::atomic<overflow_policy> policy{overflow_policy::reject};
+      std::atomic<size_t>          pending{0};
+      std::atomic<size_t>          waiters{0};
+      std::atomic<uint64_t>        rejected{0};
+      std::atomic<uint64_t>        dropped{0};
+      std::atomic<uint64_t>        blocked{0};
    };
 
-   std::priority_queue<std::unique_ptr<queued_handler_base>, std::deque<std::unique_ptr<queued_handler_base>>, deref_less> handlers_;
-   std::size_t order_ = std::numeric_limits<size_t>::max(); // to maintain FIFO ordering in queue within priority
+   /// count a new handler against the capacity of its priority, applying reject and block
+   admission admit(int priority, const cancellation_token& token, bool may_block)
+   {
+      level_limit& l = limits_[level_of(priority)];
+      const size_t capacity = l.capacity.load(std::memory_order_relaxed);
+      if( capacity == 0 )
+         return admission::unbounded;
+      if( l.pending.fetch_add(1) < capacity )
+         return admission::bounded;
+      const overflow_policy policy = l.policy.load(std::memory_order_relaxed);
+      if( policy == overflow_policy::reject ) {
+         l.pending.fetch_sub(1);
+         ++l.rejected;
+         // never queued, so it is not a tombstone, take back the count of one cancelled before the add
+         uint8_t expected = detail::cancel_state::pending;
+         if( token.state_ && !token.state_->state.compare_exchange_strong(expected, detail::cancel_state::cancelled) &&
+             expected == detail::cancel_state::cancelled )
+            token.state_->tombstones->fetch_sub(1, std::memory_order_relaxed);
+         notify_overflow(priority, policy);
+         return admission::rejected;
+      }
+      if( policy == overflow_policy::block && may_block ) {
+         // a waiter gives its slot back, otherwise waiters would hold room against each other and never wake
+         l.pending.fetch_sub(1);
+         std::unique_lock<std::mutex> lk(block_mtx_);
+         const auto take_slot = [&]() {
+            const size_t limit = l.capacity.load(std::memory_order_relaxed);
+            size_t pending = l.pending.load();
+            if( !blocking_allowed_ || limit == 0 ) {
+               ++l.pending;
+               return true;
+            }
+            while( pending < limit ) {
+               if( l.pending.compare_exchange_weak(pending, pending + 1) )
+                  return true;
+            }
+            return false;
+         };
+         if( !take_slot() ) {
+            ++l.blocked;
+            lk.unlock();
+            notify_overflow(priority, policy);
+            lk.lock();
+            ++l.waiters;
+            block_cv_.wait(lk, take_slot);
+            --l.waiters;
+         }
+      }
+      return admission::bounded;
+   }
+
+   /**
+    * drop the oldest bounded handlers of level until back within capacity, non-constant priorities are a single level.
+    * Handlers not counted against the capacity, e.g. added before it was set, are never dropped.
+    */
+   void drop_oldest(size_t level)
+   {
+      level_limit& l = limits_[level];
+      while( l.pending.load() > l.capacity.load(std::memory_order_relaxed) ) {
+         queued_handler* h = nullptr;
+         if( level < num_levels ) {
+            const size_t pos = levels_[level].find_bounded();
+            if( pos == levels_[level].size() )
+               break;
+            h = pop_level(level, pos);
+         } else {
+            // rings are FIFO, so the oldest bounded handler is the oldest of the first bounded one of each ring
+            auto oldest = other_levels_.end();
+            size_t oldest_pos = 0;
+            for( auto itr = other_levels_.begin(); itr != other_levels_.end(); ++itr ) {
+               const size_t pos = itr->second.find_bounded();
+               if( pos == itr->second.size() )
+                  continue;
+               if( oldest == other_levels_.end() || itr->second.at(pos)->enqueued_ < oldest->second.at(oldest_pos)->enqueued_ ) {
+                  oldest = itr;
+                  oldest_pos = pos;
+               }
+            }
+            if( oldest == other_levels_.end() )
+               break;
+            h = pop_other(oldest, oldest_pos);
+         }
+         uint8_t expected = detail::cancel_state::pending;
+         if( !h->cancel_ || h->cancel_->state.compare_exchange_strong(expected, detail::cancel_state::cancelled) ) {
+            ++l.dropped;
+            notify_overflow(h->priority_, overflow_policy::drop_oldest);
+         } else {
+            tombstones_->fetch_sub(1, std::memory_order_relaxed);
+            ++cancelled_count_;
+         }
+         release(h);
+      }
+   }
+
+   void notify_overflow(int priority, overflow_policy policy)
+   {
+      if( overflow_handler_ )
+         overflow_handler_(priority, policy);
+   }
+
+   /// return h to the pool, giving back its slot of the capacity of its priority
+   void release(queued_handler* h) noexcept
+   {
+      if( h->bounded_ ) {
+         level_limit& l = limits_[level_of(h->priority_)];
+         if( l.pending.fetch_sub(1) <= l.capacity.load(std::memory_order_relaxed) && l.waiters.load() ) {
+            std::lock_guard<std::mutex> g(block_mtx_);
+            block_cv_.notify_all();
+         }
+         h->bounded_ = false;
+      }
+      pool_.release(h);
+   }
+
+   queued_handler* pop()
+   {
+      if( mode_ == scheduling_mode::aging ) {
+         if( queued_handler* h = pop_overdue() )
+            return h;
+      }
+      // highest non-empty constant level is found via the bitmap, arbitrary priorities via the ordered map
+      const bool use_level = nonempty_levels_ != 0;
+      const size_t level = use_level ? highest_bit(nonempty_levels_) : 0;
+      if( use_level && (other_levels_.empty() || level_priority(level) > other_levels_.begin()->first) )
+         return pop_level(level);
+      return pop_other(other_levels_.begin());
+   }
+
+   queued_handler* pop_level(size_t level, size_t pos = 0)
+   {
+      queued_handler* h = levels_[level].erase(pos);
+      if( levels_[level].empty() )
+         nonempty_levels_ &= ~(1u << level);
+      --size_;
+      return h;
+   }
+
+   queued_handler* pop_other(ring_map::iterator itr, size_t pos = 0)
+   {
+      queued_handler* h = itr->second.erase(pos);
+      if( itr->second.empty() )
+         spare_rings_.push_back(other_levels_.extract(itr));
+      --size_;
+      return h;
+   }
+
+   /// @return the longest waiting handler if it has waited past starvation_limit_, rings are FIFO so only heads are checked
+   queued_handler* pop_overdue()
+   {
+      const auto cutoff = std::chrono::steady_clock::now() - starvation_limit_;
+      queued_handler* oldest = nullptr;
+      size_t oldest_level = num_levels;
+      for( uint32_t bits = nonempty_levels_; bits; ) {
+         const size_t level = highest_bit(bits);
+         bits &= ~(1u << level);
+         queued_handler* h = levels_[level].front();
+         if( h->enqueued_ < cutoff && (!oldest || h->enqueued_ < oldest->enqueued_) ) {
+            oldest = h;
+            oldest_level = level;
+         }
+      }
+      auto oldest_other = other_levels_.end();
+      for( auto itr = other_levels_.begin(); itr != other_levels_.end(); ++itr ) {
+         queued_handler* h = itr->second.front();
+         if( h->enqueued_ < cutoff && (!oldest || h->enqueued_ < oldest->enqueued_) ) {
+            oldest = h;
+            oldest_other = itr;
+         }
+      }
+      if( !oldest )
+         return nullptr;
+      ++aged_count_;
+      return oldest_other != other_levels_.end() ? pop_other(oldest_other) : pop_level(oldest_level);
+   }
+
+   static size_t highest_bit(uint32_t bits)
+   {
+#if defined(__GNUC__) || defined(__clang__)
+      return 31 - __builtin_clz(bits);
+#else
+      size_t r = 0;
+      while( bits >>= 1 ) ++r;
+      return r;
+#endif
+   }
+
+   /// claims a cancellable handler for execution. @return false if it was cancelled
+   bool start(queued_handler* h)
+   {
+      uint8_t expected = detail::cancel_state::pending;
+      if( !h->cancel_ || h->cancel_->state.compare_exchange_strong(expected, detail::cancel_state::started) )
+         return true;
+      tombstones_->fetch_sub(1, std::memory_order_relaxed);
+      ++cancelled_count_;
+      return false;
+   }
+
+   /// rebuild the rings without cancelled handlers once they make up half the queue
+   void maybe_compact()
+   {
+      const size_t tombstones = tombstones_->load(std::memory_order_relaxed);
+      // follow the count down as tombstones are skipped or dropped, the floor only excludes unreachable ones
+      if( tombstones + compact_threshold < compact_floor_ )
+         compact_floor_ = tombstones + compact_threshold;
+      if( tombstones < compact_floor_ || tombstones * 2 < size_ )
+         return;
+      size_ = 0;
+      const auto compact_ring = [&](handler_ring& ring) {
+         for( size_t n = ring.size(); n > 0; --n ) {
+            queued_handler* h = ring.pop_front();
+            if( still_pending(h) ) {
+               ring.push_back(h);
+               ++size_;
+            } else {
+               release(h);
+            }
+         }
+      };
+      for( size_t level = 0; level < num_levels; ++level ) {
+         compact_ring(levels_[level]);
+         if( levels_[level].empty() )
+            nonempty_levels_ &= ~(1u << level);
+      }
+      for( auto itr = other_levels_.begin(); itr != other_levels_.end(); ) {
+         auto next = std::next(itr);
+         compact_ring(itr->second);
+         if( itr->second.empty() )
+            spare_rings_.push_back(other_levels_.extract(itr));
+         itr = next;
+      }
+      // tombstones still on the incoming stack are not reachable, do not rescan for them on every call
+      compact_floor_ = tombstones_->load(std::memory_order_relaxed) + compact_threshold;
+   }
+
+   /// @return true if h is still pending, cancelled handlers are accounted for as if skipped
+   bool still_pending(queued_handler* h)
+   {
+      if( !h->cancel_ || h->cancel_->state != detail::cancel_state::cancelled )
+         return true;
+      tombstones_->fetch_sub(1, std::memory_order_relaxed);
+      ++cancelled_count_;
+      return false;
+   }
+
+   /**
+    * handler is removed from the queue before running so that it can safely add() to the queue
+    * @return false if the handler was cancelled and skipped
+    */
+   bool execute(queued_handler* h)
+   {
+      struct release_guard {
+         execution_priority_queue& q; queued_handler* h; int outer;
+         ~release_guard() { q.running_priority_ = outer; q.release(h); }
+      } guard{*this, h, running_priority_};
+      running_priority_ = h->priority_;
+      if( !start(h) )
+         return false;
+#if APPBASE_QUEUE_STATS
+      priority_stats& stats = stats_[level_of(h->priority_)];
+      const auto start = std::chrono::steady_clock::now();
+      ++stats.dequeued;
+      stats.wait.record(start - h->enqueued_);
+      h->function_();
+      stats.run.record(std::chrono::steady_clock::now() - start);
+#else
+      h->function_();
+#endif
+      return true;
+   }
+
+   /// enqueue time is needed for wait statistics, aging and to find the oldest bounded handler to drop
+   void stamp(queued_handler* h)
+   {
+      if( APPBASE_QUEUE_STATS || h->bounded_ || mode_.load(std::memory_order_relaxed) != scheduling_mode::strict )
+         h->enqueued_ = std::chrono::steady_clock::now();
+   }
+
+   handler_pool                       pool_;
+   handler_ring                       levels_[num_levels];
+   uint32_t                           nonempty_levels_ = 0; // bit n set when levels_[n] is non-empty
+   ring_map                           other_levels_;        // fallback for priorities that are not constants
+   std::vector<ring_map::node_type>   spare_rings_;
+   size_t                             size_ = 0;
+   int                                running_priority_ = priority::medium;
+   priority_stats                     stats_[num_levels + 1]; // last entry for non-constant priorities
+   std::atomic<scheduling_mode>       mode_{scheduling_mode::strict};
+   std::chrono::microseconds          starvation_limit_{0};
+   uint64_t                           aged_count_ = 0;
+   static constexpr size_t            compact_threshold = 1024;
+   // cancelled handlers still queued or incoming
+   std::shared_ptr<std::atomic<size_t>> tombstones_ = std::make_shared<std::atomic<size_t>>(0);
+   size_t                             compact_floor_ = compact_threshold;
+   uint64_t                           cancelled_count_ = 0;
+   std::atomic<queued_handler*>       incoming_{nullptr};   // lock-free stack, newest first
+   level_limit                        limits_[num_levels + 1]; // last entry for non-constant priorities
+   std::function<void(int, overflow_policy)> overflow_handler_;
+   std::mutex                         block_mtx_;
+   std::condition_variable            block_cv_;
+   bool                               blocking_allowed_ = false;
 };
 
 } // appbase
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace appbase { namespace detail {
+
+   /**
+    * Index range [begin, end) split evenly over a number of participants. Each participant takes small blocks from
+    * the front of its own share; once that is exhausted it steals the back half of the next share that has work
+    * left, so participants finish at about the same time even when items take uneven time.
+    */
+   class parallel_range {
+      public:
+         parallel_range( size_t begin, size_t end, size_t participants )
+         : _shares( new share[participants] ), _participants( participants ) {
+            const size_t count = end - begin;
+            _grain = std::max<size_t>( count / (participants * 16), 1 );
+            for( size_t p = 0; p < participants; ++p ) {
+               _shares[p].next = begin + count * p / participants;
+               _shares[p].end  = begin + count * (p + 1) / participants;
+            }
+         }
+
+         size_t participants() const { return _participants; }
+
+         /// @return true once every item has been handed out
+         bool exhausted() {
+            for( size_t p = 0; p < _participants; ++p ) {
+               std::lock_guard<std::mutex> g( _shares[p].mtx );
+               if( _shares[p].next != _shares[p].end )
+                  return false;
+            }
+            return true;
+         }
+
+         /**
+          * @return false once no work is left anywhere, otherwise [first, last) is the next block for participant
+          */
+         bool next( size_t participant, size_t& first, size_t& last ) {
+            share& own = _shares[participant];
+            {
+               std::lock_guard<std::mutex> g( own.mtx );
+               if( take( own, first, last ) )
+                  return true;
+            }
+            for( size_t k = 1; k < _participants; ++k ) {
+               share& victim = _shares[(participant + k) % _participants];
+               size_t from, to;
+               {
+                  std::lock_guard<std::mutex> g( victim.mtx );
+                  const size_t remaining = victim.end - victim.next;
+                  if( remaining == 0 )
+                     continue;
+                  if( remaining <= _grain ) {
+                     first = victim.next;
+                     last = victim.end;
+                     victim.next = victim.end;
+                     return true;
+                  }
+                  from = victim.next + remaining / 2;
+                  to = victim.end;
+                  victim.end = from;
+               }
+               std::lock_guard<std::mutex> g( own.mtx );
+               own.next = from;
+               own.end = to;
+               take( own, first, last );
+               return true;
+            }
+            return false;
+         }
+
+      private:
+         struct alignas(64) share {
+            std::mutex mtx;
+            size_t     next = 0;
+            size_t     end = 0;
+         };
+
+         bool take( share& s, size_t& first, size_t& last ) {
+            if( s.next == s.end )
+               return false;
+            first = s.next;
+            last = std::min( s.next + _grain, s.end );
+            s.next = last;
+            return true;
+         }
+
+         std::unique_ptr<share[]> _shares;
+         size_t                   _participants;
+         size_t                   _grain;
+   };
+
+   /**
+    * State of one application::parallel_for() or parallel_reduce(), shared by its participants. body(participant,
+    * first, last) processes a block, finish(error) is called once by the last participant to return. After an
+    * exception the remaining blocks are skipped and finish receives the first exception.
+    *
+    * A participant that never runs, e.g. discarded when the worker pool stopped, must call discard() instead of
+    * run(). Its share is stolen by the participants that do run. If none is left to process it, finish receives a
+    * std::future_error with std::future_errc::broken_promise.
+    */
+   template<typename Body, typename Finish>
+   class parallel_job {
+      public:
+         parallel_job( size_t begin, size_t end, size_t participants, Body body, Finish finish )
+         : _range( begin, end, participants ), _active( participants ), _body( std::move(body) ), _finish( std::move(finish) ) {}
+
+         void run( size_t participant ) {
+            try {
+               size_t first, last;
+               while( !_failed.load( std::memory_order_relaxed ) && _range.next( participant, first, last ) )
+                  _body( participant, first, last );
+            } catch( ... ) {
+               std::lock_guard<std::mutex> g( _error_mtx );
+               if( !_error )
+                  _error = std::current_exception();
+               _failed = true;
+            }
+            leave();
+         }
+
+         void discard() noexcept {
+            try {
+               leave();
+            } catch( ... ) {} // finish failed to post, nothing left to report it with
+         }
+
+      private:
+         void leave() {
+            if( _active.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+               return;
+            if( !_error && !_range.exhausted() )
+               _error = std::make_exception_ptr( std::future_error( std::future_errc::broken_promise ) );
+            _finish( std::move(_error) );
+         }
+
+         parallel_range      _range;
+         std::atomic<size_t> _active;
+         std::atomic<bool>   _failed{false};
+         std::mutex          _error_mtx;
+         std::exception_ptr  _error;
+         Body                _body;
+         Finish              _finish;
+   };
+
+} }
@@ -0,0 +1,539 @@
+#pragma once
+#include <appbase/small_handler.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace appbase {
+
+namespace detail {
+   /**
+    * Handler for priority_thread_pool that calls on_discard instead of function when it is destroyed without having
+    * run, e.g. by priority_thread_pool::stop(). on_discard must not throw.
+    */
+   template <typename Function, typename OnDiscard>
+   class discardable_handler
+   {
+   public:
+      discardable_handler(Function f, OnDiscard d) : function_(std::move(f)), on_discard_(std::move(d)) {}
+      discardable_handler(discardable_handler&& o) noexcept
+            : function_(std::move(o.function_)), on_discard_(std::move(o.on_discard_)), armed_(std::exchange(o.armed_, false))
+      {
+      }
+      discardable_handler& operator=(discardable_handler&&) = delete;
+
+      ~discardable_handler()
+      {
+         if( armed_ )
+            on_discard_();
+      }
+
+      void operator()()
+      {
+         armed_ = false;
+         function_();
+      }
+
+   private:
+      Function  function_;
+      OnDiscard on_discard_;
+      bool      armed_ = true;
+   };
+
+   template <typename Function, typename OnDiscard>
+   discardable_handler<std::decay_t<Function>, std::decay_t<OnDiscard>> make_discardable(Function&& f, OnDiscard&& d)
+   {
+      return { std::forward<Function>(f), std::forward<OnDiscard>(d) };
+   }
+}
+
+/**
+ * A pool of threads that runs handlers in priority order, larger priorities first and FIFO within a priority,
+ * using the same appbase::priority constants as execution_priority_queue.
+ *
+ * Handlers may be posted with a key. Like a strand, handlers with the same key never run concurrently and run
+ * in (priority, FIFO) order relative to each other, while handlers with different keys, or without a key, run
+ * in parallel on whichever threads are free.
+ */
+class priority_thread_pool
+{
+public:
+   using key_type = uint64_t;
+
+   priority_thread_pool() = default;
+   ~priority_thread_pool() { stop(); }
+
+   priority_thread_pool(const priority_thread_pool&) = delete;
+   priority_thread_pool& operator=(const priority_thread_pool&) = delete;
+
+   /**
+    * Start num_threads threads. Handlers posted before start() are kept and run once threads are available.
+    */
+   void start(size_t num_threads)
+   {
+      scaling_config config;
+      config.min_threads = config.max_threads = num_threads;
+      start(config);
+   }
+
+   /**
+    * Called at the start of every thread of the pool with a number identifying the thread, counting from 1, e.g. to
+    * name it. Set before start().
+    */
+   void set_thread_start(std::function<void(size_t index)> f)
+   {
+      thread_start_ = std::move(f);
+   }
+
+   /**
+    * Called on the pool thread with the priority of a handler that threw and the exception, after the handler's
+    * strand, if any, has been released so the next handler of its key can run. Without one an exception escaping a
+    * handler calls std::terminate. Set before start().
+    */
+   void set_exception_handler(std::function<void(int priority, std::exception_ptr)> f)
+   {
+      exception_handler_ = std::move(f);
+   }
+
+   /**
+    * Limits and thresholds of an elastic pool, which starts with min_threads threads and adds threads up to
+    * max_threads while handlers back up. Threads are added quickly, at most one per grow_interval, and removed
+    * slowly, once idle for idle_timeout, so that a pool does not oscillate around a threshold. With min_threads 0
+    * no thread runs until a handler is posted, and the pool shrinks back to no threads when idle.
+    */
+   struct scaling_config
+   {
+      size_t                    min_threads = 1;
+      size_t                    max_threads = 1;
+      size_t                    grow_depth = 4;                          ///< add a thread when more handlers than this per thread are waiting
+      std::chrono::microseconds grow_wait = std::chrono::milliseconds(1); ///< or when a handler waited longer than this to start
+      std::chrono::milliseconds grow_interval{10};
+      std::chrono::milliseconds idle_timeout{5000};
+   };
+
+   /**
+    * Start config.min_threads threads, growing to config.max_threads on demand when that is larger.
+    */
+   void start(const scaling_config& config)
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      stopping_ = false;
+      config_ = config;
+      config_.max_threads = std::max(config.min_threads, config.max_threads);
+      elastic_ = config_.max_threads > config_.min_threads;
+      for( size_t i = 0; i < config_.min_threads; ++i )
+         spawn();
+      // handlers posted before start() to a pool without a minimum
+      maybe_grow_for_depth();
+   }
+
+   /**
+    * Wait for running handlers to complete, join all threads and destroy any handlers not yet executed.
+    */
+   void stop()
+   {
+      std::vector<std::unique_ptr<worker>> workers;
+      {
+         std::lock_guard<std::mutex> g(mtx_);
+         stopping_ = true;
+         workers.swap(workers_);
+         for( auto& w : retired_ )
+            workers.push_back(std::move(w));
+         retired_.clear();
+      }
+      cv_.notify_all();
+      for( auto& w : workers )
+         w->thread_.join();
+
+      std::lock_guard<std::mutex> g(mtx_);
+      while( !ready_.empty() ) {
+         if( ready_.top().node_ )
+            delete ready_.top().node_;
+         ready_.pop();
+      }
+      for( auto& s : strands_ ) {
+         while( !s.second.pending_.empty() ) {
+            delete s.second.pending_.top();
+            s.second.pending_.pop();
+         }
+      }
+      strands_.clear();
+      size_ = 0;
+   }
+
+   size_t num_threads() const
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      return workers_.size();
+   }
+
+   /// Number of threads the pool may grow to, num_threads() of a pool that is not elastic
+   size_t max_threads() const
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      return config_.max_threads;
+   }
+
+   struct scaling_stats
+   {
+      uint64_t grown_for_depth = 0; ///< threads added because too many handlers were waiting
+      uint64_t grown_for_wait = 0;  ///< threads added because a handler waited longer than grow_wait
+      uint64_t shrunk = 0;          ///< threads that exited after idle_timeout
+      size_t   peak_threads = 0;
+      std::chrono::steady_clock::time_point last_event; ///< time of the last thread added or removed
+   };
+
+   /// Thread safe
+   scaling_stats scaling() const
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      return scaling_stats_;
+   }
+
+   struct thread_stats
+   {
+      uint64_t                 handlers = 0; ///< handlers run
+      std::chrono::nanoseconds busy{0};      ///< time spent running handlers
+      std::chrono::nanoseconds lifetime{0};  ///< time since the thread started
+
+      double utilization() const { return lifetime.count() ? double(busy.count()) / lifetime.count() : 0.0; }
+   };
+
+   /**
+    * Thread safe, costs two clock reads per handler.
+    * @return statistics of each running thread
+    */
+   std::vector<thread_stats> stats() const
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      const auto now = std::chrono::steady_clock::now();
+      std::vector<thread_stats> r;
+      r.reserve(workers_.size());
+      for( const auto& w : workers_ ) {
+         r.push_back(thread_stats{ w->handlers_.load(std::memory_order_relaxed),
+                                   std::chrono::nanoseconds(w->busy_ns_.load(std::memory_order_relaxed)),
+                                   now - w->started_ });
+      }
+      return r;
+   }
+
+   /// Number of handlers waiting to run
+   size_t size() const
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      return size_;
+   }
+
+   /**
+    * Post a handler that may run concurrently with any other handler.
+    */
+   template <typename Function>
+   void post(int priority, Function&& function)
+   {
+      auto n = std::make_unique<queued_handler>(priority, std::forward<Function>(function));
+      {
+         std::lock_guard<std::mutex> g(mtx_);
+         n->order_ = ++order_;
+         ready_.push(ready_entry{n->priority_, n->order_, n.get(), nullptr});
+         stamp(*n);
+         n.release();
+         ++size_;
+         maybe_grow_for_depth();
+      }
+      cv_.notify_one();
+   }
+
+   /**
+    * Post a handler that is serialized with all other handlers posted with the same key.
+    */
+   template <typename Function>
+   void post(int priority, key_type key, Function&& function)
+   {
+      auto n = std::make_unique<queued_handler>(priority, std::forward<Function>(function));
+      bool notify = false;
+      {
+         std::lock_guard<std::mutex> g(mtx_);
+         strand_state& s = strands_[key];
+         s.key_ = key;
+         n->order_ = ++order_;
+         n->strand_ = &s;
+         s.pending_.push(n.get());
+         stamp(*n);
+         n.release();
+         ++size_;
+         maybe_grow_for_depth();
+         // a running strand schedules its next handler when the current one completes
+         if( !s.running_ && s.pending_.top()->order_ == order_ ) {
+            ++s.tickets_;
+            ready_.push(ready_entry{priority, order_, nullptr, &s});
+            notify = true;
+         }
+      }
+      if( notify )
+         cv_.notify_one();
+   }
+
+private:
+   struct strand_state;
+
+   struct queued_handler
+   {
+      template <typename Function>
+      queued_handler(int priority, Function&& f)
+            : priority_(priority), function_(std::forward<Function>(f))
+      {
+      }
+
+      int           priority_;
+      uint64_t      order_ = 0;
+      strand_state* strand_ = nullptr;
+      std::chrono::steady_clock::time_point enqueued_; // only set when posted to a started elastic pool
+      small_handler function_;
+   };
+
+   /// larger priority first, then lower order (earlier post) first
+   template <typename T>
+   static bool runs_after(const T& a, const T& b)
+   {
+      return a.priority_ < b.priority_ || (a.priority_ == b.priority_ && a.order_ > b.order_);
+   }
+
+   struct handler_less
+   {
+      bool operator()(const queued_handler* a, const queued_handler* b) const { return runs_after(*a, *b); }
+   };
+
+   struct strand_state
+   {
+      std::priority_queue<queued_handler*, std::vector<queued_handler*>, handler_less> pending_;
+      key_type key_ = 0;
+      bool     running_ = false;
+      size_t   tickets_ = 0; // ready_ entries referencing this strand
+   };
+
+   /**
+    * Either an unkeyed handler or a ticket for the best pending handler of a strand. A ticket is stale when the
+    * strand is running or its best pending handler no longer has the ticket's order; stale tickets are dropped.
+    */
+   struct ready_entry
+   {
+      int             priority_;
+      uint64_t        order_;
+      queued_handler* node_;
+      strand_state*   strand_;
+
+      bool operator<(const ready_entry& b) const { return runs_after(*this, b); }
+   };
+
+   /// @return next handler to run or nullptr, marks its strand running. mtx_ must be held.
+   queued_handler* pop_ready()
+   {
+      while( !ready_.empty() ) {
+         ready_entry e = ready_.top();
+         ready_.pop();
+         if( e.node_ ) {
+            --size_;
+            return e.node_;
+         }
+         strand_state& s = *e.strand_;
+         --s.tickets_;
+         if( !s.running_ && !s.pending_.empty() && s.pending_.top()->order_ == e.order_ ) {
+            queued_handler* n = s.pending_.top();
+            s.pending_.pop();
+            s.running_ = true;
+            --size_;
+            return n;
+         }
+         erase_if_idle(s);
+      }
+      return nullptr;
+   }
+
+   /// called after n has run. mtx_ must be held. @return true if another handler became ready
+   bool complete(queued_handler* n)
+   {
+      strand_state* s = n->strand_;
+      if( !s )
+         return false;
+      s->running_ = false;
+      if( !s->pending_.empty() ) {
+         queued_handler* next = s->pending_.top();
+         ++s->tickets_;
+         ready_.push(ready_entry{next->priority_, next->order_, nullptr, s});
+         return true;
+      }
+      erase_if_idle(*s);
+      return false;
+   }
+
+   void erase_if_idle(strand_state& s)
+   {
+      if( !s.running_ && s.tickets_ == 0 && s.pending_.empty() )
+         strands_.erase(s.key_);
+   }
+
+   struct worker
+   {
+      std::thread                           thread_;
+      std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
+      std::atomic<uint64_t>                 handlers_{0};
+      std::atomic<int64_t>                  busy_ns_{0};
+   };
+
+   void stamp(queued_handler& n)
+   {
+      if( elastic_ )
+         n.enqueued_ = std::chrono::steady_clock::now();
+   }
+
+   /// mtx_ must be held
+   void spawn()
+   {
+      workers_.emplace_back(new worker);
+      worker* w = workers_.back().get();
+      w->thread_ = std::thread([this, w, index = ++spawned_]() {
+         if( thread_start_ )
+            thread_start_(index);
+         run(*w);
+      });
+      scaling_stats_.peak_threads = std::max(scaling_stats_.peak_threads, workers_.size());
+   }
+
+   /// mtx_ must be held. @return true if the pool may add a thread now
+   bool may_grow(std::chrono::steady_clock::time_point now) const
+   {
+      if( !elastic_ || stopping_ || workers_.size() >= config_.max_threads )
+         return false;
+      // a pool without threads starts one as soon as there is work
+      return workers_.empty() || (idle_ == 0 && now - scaling_stats_.last_event >= config_.grow_interval);
+   }
+
+   void maybe_grow_for_depth()
+   {
+      if( !elastic_ || size_ <= config_.grow_depth * workers_.size() )
+         return;
+      const auto now = std::chrono::steady_clock::now();
+      if( !may_grow(now) )
+         return;
+      spawn();
+      ++scaling_stats_.grown_for_depth;
+      scaling_stats_.last_event = now;
+   }
+
+   void maybe_grow_for_wait(const queued_handler& n)
+   {
+      if( !elastic_ )
+         return;
+      const auto now = std::chrono::steady_clock::now();
+      // handlers posted before start() are not stamped, their wait says nothing about the number of threads
+      if( size_ == 0 || n.enqueued_ == std::chrono::steady_clock::time_point() || now - n.enqueued_ <= config_.grow_wait ||
+          !may_grow(now) )
+         return;
+      spawn();
+      ++scaling_stats_.grown_for_wait;
+      scaling_stats_.last_event = now;
+   }
+
+   /// called by w when idle past idle_timeout. mtx_ must be held. @return true if w should exit
+   bool retire(worker& w)
+   {
+      if( stopping_ || workers_.size() <= config_.min_threads )
+         return false;
+      for( auto itr = workers_.begin(); itr != workers_.end(); ++itr ) {
+         if( itr->get() == &w ) {
+            retired_.push_back(std::move(*itr));
+            workers_.erase(itr);
+            break;
+         }
+      }
+      ++scaling_stats_.shrunk;
+      scaling_stats_.last_event = std::chrono::steady_clock::now();
+      return true;
+   }
+
+   void run(worker& w)
+   {
+      std::unique_lock<std::mutex> lk(mtx_);
+      while( !stopping_ ) {
+         queued_handler* n = pop_ready();
+         if( !n ) {
+            ++idle_;
+            const bool timed_out = elastic_ && cv_.wait_for(lk, config_.idle_timeout) == std::cv_status::timeout;
+            if( !elastic_ )
+               cv_.wait(lk);
+            --idle_;
+            if( timed_out && ready_.empty() && retire(w) ) {
+               // join threads that retired before this one, without holding mtx_ and off the posting threads
+               std::vector<std::unique_ptr<worker>> earlier;
+               for( auto& r : retired_ ) {
+                  if( r.get() != &w )
+                     earlier.push_back(std::move(r));
+               }
+               retired_.erase(std::remove(retired_.begin(), retired_.end(), nullptr), retired_.end());
+               lk.unlock();
+               for( auto& r : earlier )
+                  r->thread_.join();
+               return;
+            }
+            continue;
+         }
+         // a handler that waited too long while the remaining ones are still queued, more threads would help
+         maybe_grow_for_wait(*n);
+         lk.unlock();
+         const auto start = std::chrono::steady_clock::now();
+         std::unique_ptr<queued_handler> guard(n);
+         std::exception_ptr error;
+         if( exception_handler_ ) {
+            try {
+               n->function_();
+            } catch( ... ) {
+               error = std::current_exception();
+            }
+         } else {
+            n->function_();
+         }
+         n->function_.reset();
+         w.handlers_.fetch_add(1, std::memory_order_relaxed);
+         w.busy_ns_.fetch_add(std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count(),
+                              std::memory_order_relaxed);
+         lk.lock();
+         if( complete(n) )
+            cv_.notify_one();
+         if( error ) {
+            lk.unlock();
+            exception_handler_(n->priority_, error);
+            lk.lock();
+         }
+      }
+   }
+
+   mutable std::mutex                                 mtx_;
+   std::condition_variable                            cv_;
+   std::priority_queue<ready_entry>                   ready_;
+   std::unordered_map<key_type, strand_state>         strands_;
+   uint64_t                                           order_ = 0;
+   size_t                                             size_ = 0;
+   bool                                               stopping_ = false;
+   std::vector<std::unique_ptr<worker>>               workers_;
+   std::vector<std::unique_ptr<worker>>               retired_; // exited after idle_timeout, joined by the next to retire or stop()
+   scaling_config                                     config_;
+   bool                                               elastic_ = false;
+   size_t                                             idle_ = 0; // threads waiting for a handler
+   size_t                                             spawned_ = 0;
+   std::function<void(size_t)>                        thread_start_;
+   std::function<void(int, std::exception_ptr)>       exception_handler_;
+   scaling_stats                                      scaling_stats_;
+};
+
+} // appbase
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace appbase {
+
+   template<typename T>
+   class result_future;
+
+   namespace detail {
+      /**
+       * Shared state between a result_future and the handler producing its value. States are recycled through a
+       * small per thread cache. Once a cache is full, released states go to a lock-free returned stack from which
+       * empty caches are refilled, so states released on the main thread make it back to the posting threads.
+       */
+      template<typename T>
+      class result_state {
+         public:
+            using value_type = std::conditional_t<std::is_void<T>::value, bool, T>;
+
+            /// @return a state referenced by one future and one producer
+            static result_state* acquire() {
+               cache& c = cache::local();
+               if( !c.head ) {
+                  c.head = returned().exchange( nullptr, std::memory_order_acquire );
+                  c.size = 0;
+                  for( result_state* s = c.head; s; s = s->_next )
+                     ++c.size;
+               }
+               result_state* s = c.head;
+               if( s ) {
+                  c.head = s->_next;
+                  --c.size;
+               } else {
+                  s = new result_state;
+               }
+               s->_refs.store( 2, std::memory_order_relaxed );
+               return s;
+            }
+
+            void release() {
+               if( _refs.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+                  return;
+               _value.reset();
+               _error = nullptr;
+               _ready = false;
+               cache& c = cache::local();
+               if( c.size >= cache::max_size ) {
+                  result_state* head = returned().load( std::memory_order_relaxed );
+                  do {
+                     _next = head;
+                  } while( !returned().compare_exchange_weak( head, this, std::memory_order_release, std::memory_order_relaxed ) );
+                  return;
+               }
+               _next = c.head;
+               c.head = this;
+               ++c.size;
+            }
+
+            template<typename Func>
+            void set_from( Func& f ) {
+               try {
+                  if constexpr( std::is_void<T>::value ) {
+                     f();
+                     _value.emplace( true );
+                  } else {
+                     _value.emplace( f() );
+                  }
+               } catch( ... ) {
+                  _error = std::current_exception();
+               }
+               notify();
+            }
+
+            void set_error( std::exception_ptr e ) {
+               _error = std::move( e );
+               notify();
+            }
+
+            bool ready() const {
+               std::lock_guard<std::mutex> g( _mtx );
+               return _ready;
+            }
+
+            void wait() {
+               std::unique_lock<std::mutex> lk( _mtx );
+               _cv.wait( lk, [this]() { return _ready; } );
+            }
+
+            template<typename Rep, typename Period>
+            bool wait_for( const std::chrono::duration<Rep, Period>& d ) {
+               std::unique_lock<std::mutex> lk( _mtx );
+               return _cv.wait_for( lk, d, [this]() { return _ready; } );
+            }
+
+            value_type take() {
+               wait();
+               if( _error )
+                  std::rethrow_exception( _error );
+               return std::move( *_value );
+            }
+
+         private:
+            struct cache {
+               static constexpr size_t max_size = 64;
+
+               ~cache() { delete_list( head ); }
+
+               static void delete_list( result_state* s ) {
+                  while( s ) {
+                     result_state* next = s->_next;
+                     delete s;
+                     s = next;
+                  }
+               }
+
+               static cache& local() {
+                  static thread_local cache c;
+                  return c;
+               }
+
+               result_state* head = nullptr;
+               size_t        size = 0;
+            };
+
+            struct returned_stack : std::atomic<result_state*> {
+               returned_stack() : std::atomic<result_state*>( nullptr ) {}
+               ~returned_stack() { cache::delete_list( this->exchange( nullptr ) ); }
+            };
+
+            static std::atomic<result_state*>& returned() {
+               static returned_stack r;
+               return r;
+            }
+
+            void notify() {
+               {
+                  std::lock_guard<std::mutex> g( _mtx );
+                  _ready = true;
+               }
+               _cv.notify_all();
+            }
+
+            std::atomic<int>           _refs{0};
+            mutable std::mutex         _mtx;
+            std::condition_variable    _cv;
+            bool                       _ready = false;
+            std::optional<value_type>  _value;
+            std::exception_ptr         _error;
+            result_state*              _next = nullptr;
+      };
+
+      /**
+       * Producer side of a result_future, owned by the queued handler. If the handler is destroyed without having
+       * run, e.g. rejected by a priority at capacity or discarded at shutdown, the future gets a broken_promise error.
+       */
+      template<typename T>
+      class result_promise {
+         public:
+            explicit result_promise( result_state<T>* s ) : _state( s ) {}
+            result_promise( result_promise&& o ) noexcept : _state( std::exchange( o._state, nullptr ) ) {}
+            result_promise& operator=( result_promise&& ) = delete;
+
+            ~result_promise() {
+               if( !_state )
+                  return;
+               if( !_done )
+                  _state->set_error( std::make_exception_ptr( std::future_error( std::future_errc::broken_promise ) ) );
+               _state->release();
+            }
+
+            template<typename Func>
+            void set_from( Func& f ) {
+               _done = true;
+               _state->set_from( f );
+            }
+
+         private:
+            result_state<T>* _state;
+            bool             _done = false;
+      };
+   }
+
+   /**
+    * Result of application::post_with_result(). Move-only, a value can be retrieved once with get().
+    *
+    * get() and wait() block until the handler has run, so they must not be called from the thread running
+    * application::exec() before that.
+    */
+   template<typename T>
+   class result_future {
+      public:
+         result_future() = default;
+         explicit result_future( detail::result_state<T>* s ) : _state( s ) {}
+         result_future( result_future&& o ) noexcept : _state( std::exchange( o._state, nullptr ) ) {}
+         result_future& operator=( result_future&& o ) noexcept {
+            if( this != &o ) {
+               reset();
+               _state = std::exchange( o._state, nullptr );
+            }
+            return *this;
+         }
+         ~result_future() { reset(); }
+
+         bool valid() const { return _state != nullptr; }
+
+         /// @return true once the handler has run, or was discarded
+         bool ready() const { return _state->ready(); }
+
+         void wait() const { _state->wait(); }
+
+         /// @return true if ready within d
+         template<typename Rep, typename Period>
+         bool wait_for( const std::chrono::duration<Rep, Period>& d ) const { return _state->wait_for( d ); }
+
+         /**
+          * Wait for and return the value, rethrowing what the handler threw. Throws std::future_error with
+          * broken_promise if the handler was discarded without running. Leaves the future invalid.
+          */
+         T get() {
+            result_future f( std::move(*this) );
+            if constexpr( std::is_void<T>::value )
+               f._state->take();
+            else
+               return f._state->take();
+         }
+
+      private:
+         void reset() {
+            if( _state )
+               _state->release();
+            _state = nullptr;
+         }
+
+         detail::result_state<T>* _state = nullptr;
+   };
+
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace appbase {
+
+/**
+ * Move-only, type-erased `void()` callable with inline storage for small functors.
+ *
+ * Callables that fit in inline_size bytes and are nothrow move constructible are stored in place, anything
+ * else falls back to a single heap allocation. Unlike std::function the wrapped callable does not need to be
+ * copyable, so lambdas capturing unique_ptr or other move-only state can be queued.
+ */
+class small_handler {
+public:
+   static constexpr std::size_t inline_size = 6 * sizeof(void*);
+
+   small_handler() noexcept = default;
+
+   template<typename Function,
+            typename = std::enable_if_t<!std::is_same<std::decay_t<Function>, small_handler>::value>>
+   small_handler(Function&& f)
+   {
+      construct<std::decay_t<Function>>(std::forward<Function>(f));
+   }
+
+   small_handler(small_handler&& other) noexcept
+   {
+      move_from(other);
+   }
+
+   small_handler& operator=(small_handler&& other) noexcept
+   {
+      if( this != &other ) {
+         reset();
+         move_from(other);
+      }
+      return *this;
+   }
+
+   // dont allow copying, the wrapped callable may be move-only
+   small_handler(const small_handler&) = delete;
+   small_handler& operator=(const small_handler&) = delete;
+
+   ~small_handler() { reset(); }
+
+   void operator()() { ops_->invoke(buffer_); }
+
+   explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+   void reset() noexcept
+   {
+      if( ops_ ) {
+         ops_->destroy(buffer_);
+         ops_ = nullptr;
+      }
+   }
+
+   /**
+    * @return true if a callable of type Function is stored without a heap allocation
+    */
+   template<typename Function>
+   static constexpr bool stored_inline()
+   {
+      return sizeof(Function) <= inline_size && alignof(Function) <= alignof(std::max_align_t) &&
+             std::is_nothrow_move_constructible<Function>::value;
+   }
+
+private:
+   struct ops_type {
+      void (*invoke)(void*);
+      void (*move)(void* dst, void* src);
+      void (*destroy)(void*);
+   };
+
+   template<typename Function>
+   struct inline_ops {
+      static void invoke(void* p)             { (*static_cast<Function*>(p))(); }
+      static void move(void* dst, void* src) {
+         new (dst) Function(std::move(*static_cast<Function*>(src)));
+         static_cast<Function*>(src)->~Function();
+      }
+      static void destroy(void* p)            { static_cast<Function*>(p)->~Function(); }
+   };
+
+   template<typename Function>
+   struct heap_ops {
+      static void invoke(void* p)             { (**static_cast<Function**>(p))(); }
+      static void move(void* dst, void* src) { *static_cast<Function**>(dst) = *static_cast<Function**>(src); }
+      static void destroy(void* p)            { delete *static_cast<Function**>(p); }
+   };
+
+   template<typename Function>
+   static const ops_type* ops_for()
+   {
+      using ops = std::conditional_t<stored_inline<Function>(), inline_ops<Function>, heap_ops<Function>>;
+      static constexpr ops_type table{ &ops::invoke, &ops::move, &ops::destroy };
+      return &table;
+   }
+
+   template<typename Function, typename F>
+   std::enable_if_t<stored_inline<Function>()> construct(F&& f)
+   {
+      new (buffer_) Function(std::forward<F>(f));
+      ops_ = ops_for<Function>();
+   }
+
+   template<typename Function, typename F>
+   std::enable_if_t<!stored_inline<Function>()> construct(F&& f)
+   {
+      *reinterpret_cast<Function**>(buffer_) = new Function(std::forward<F>(f));
+      ops_ = ops_for<Function>();
+   }
+
+   void move_from(small_handler& other) noexcept
+   {
+      if( other.ops_ ) {
+         other.ops_->move(buffer_, other.buffer_);
+         ops_ = other.ops_;
+         other.ops_ = nullptr;
+      }
+   }
+
+   alignas(std::max_align_t) unsigned char buffer_[inline_size];
+   const ops_type* ops_ = nullptr;
+};
+
+} // appbase
@@ -0,0 +1,87 @@
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define APPBASE_HAS_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace appbase {
+
+   /**
+    * Return type for coroutine handlers that give way to higher priority work part way through, available when
+    * compiled as C++20. The coroutine starts running when called, so it can be posted like any other handler:
+    *
+    *    app().post( priority::low, []() { return replay_blocks( first, last ); } );
+    *
+    *    task replay_blocks( uint32_t first, uint32_t last ) {
+    *       for( auto n = first; n <= last; ++n ) {
+    *          apply_block( n );
+    *          co_await app().yield();
+    *       }
+    *    }
+    *
+    * Every co_await of app().yield() or app().schedule() re-queues the rest of the coroutine, everything with a
+    * higher priority that was queued in the meantime runs first. Captures of a coroutine lambda are not kept alive
+    * across a suspension, pass state as parameters which are copied into the coroutine frame instead.
+    *
+    * An exception escaping the coroutine is kept in its promise until the coroutine has finished, then rethrown
+    * from exec() by a handler posted at the priority of the handler that was running the coroutine.
+    */
+   class task {
+      public:
+         struct promise_type;
+
+         /// destroys the finished coroutine and posts the rethrow of its exception, if any
+         struct final_awaiter {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend( std::coroutine_handle<promise_type> h ) noexcept;
+            void await_resume() const noexcept {}
+         };
+
+         struct promise_type {
+            task get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            final_awaiter final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+            std::exception_ptr exception;
+         };
+   };
+
+   /**
+    * Awaitable returned by application::yield() and application::schedule(), resumes the awaiting coroutine from
+    * the priority queue. A suspended coroutine that is never resumed, because the queue is destroyed or its
+    * priority is at capacity and rejects or drops it, is destroyed like any other discarded handler.
+    */
+   class priority_awaitable {
+      public:
+         explicit priority_awaitable( int priority ) : _priority( priority ) {}
+
+         bool await_ready() const noexcept { return false; }
+         void await_suspend( std::coroutine_handle<> h );
+         void await_resume() const noexcept {}
+
+      private:
+         /// queued handler owning the suspended coroutine, destroys it if never resumed, e.g. at shutdown
+         class resumer {
+            public:
+               explicit resumer( std::coroutine_handle<> h ) : _handle( h ) {}
+               resumer( resumer&& o ) noexcept : _handle( std::exchange( o._handle, nullptr ) ) {}
+               resumer& operator=( resumer&& ) = delete;
+               ~resumer() { if( _handle ) _handle.destroy(); }
+
+               void operator()() { std::exchange( _handle, nullptr ).resume(); }
+
+            private:
+               std::coroutine_handle<> _handle;
+         };
+
+         int _priority;
+   };
+
+}
+
+#endif
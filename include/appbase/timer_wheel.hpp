@@ -0,0 +1,281 @@
+#pragma once
+#include <appbase/small_handler.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace appbase {
+
+class timer_wheel;
+
+namespace detail {
+   struct timer_entry
+   {
+      using clock = std::chrono::steady_clock;
+
+      // wheel slot list links, only valid while armed
+      timer_entry*  prev_ = nullptr;
+      timer_entry*  next_ = nullptr;
+      timer_entry** slot_ = nullptr;
+      uint64_t      tick_ = 0;
+
+      clock::time_point             when_;    // scheduled expiry, advanced by period_ for periodic timers
+      clock::duration               period_{0};
+      int                           priority_ = 0;
+      std::atomic<bool>             cancelled_{false};
+      std::atomic<bool>             expired_{false}; // one-shot timer has fired
+      small_handler                 function_;
+      std::shared_ptr<timer_entry>  self_;    // the wheel owns armed entries
+   };
+}
+
+/**
+ * Handle to a timer armed with application::post_after() or application::post_every().
+ * Dropping the handle does not cancel the timer.
+ */
+class timer_handle
+{
+public:
+   timer_handle() = default;
+
+   /**
+    * Cancel the timer, O(1). Safe to call from any thread. If the timer already expired and its handler is waiting
+    * in the priority queue, the handler is skipped.
+    */
+   inline void cancel();
+
+   /// @return true until the timer is cancelled, or for a one-shot timer, has expired
+   bool active() const { return entry_ && !entry_->cancelled_ && !entry_->expired_; }
+
+private:
+   timer_handle(std::shared_ptr<detail::timer_entry> e, timer_wheel* w) : entry_(std::move(e)), wheel_(w) {}
+
+   std::shared_ptr<detail::timer_entry> entry_;
+   timer_wheel*                         wheel_ = nullptr;
+
+   friend class timer_wheel;
+};
+
+/**
+ * Hierarchical timing wheel: 256 slots of one tick followed by three levels of 64 slots, each slot covering a full
+ * revolution of the level below, for a range of 2^26 ticks before far timers are re-cascaded. Arming and
+ * cancelling are O(1) under a mutex. Expiry is driven by the owner calling expire() from a single thread, an
+ * entry never fires before its scheduled time.
+ */
+class timer_wheel
+{
+public:
+   using clock = std::chrono::steady_clock;
+   using entry_ptr = std::shared_ptr<detail::timer_entry>;
+
+   explicit timer_wheel(clock::duration resolution = std::chrono::milliseconds(1))
+         : resolution_(resolution), epoch_(clock::now())
+   {
+   }
+
+   ~timer_wheel()
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      for( auto& level : slots_ )
+         for( auto& slot : level )
+            while( slot )
+               unlink(*slot);
+   }
+
+   timer_wheel(const timer_wheel&) = delete;
+   timer_wheel& operator=(const timer_wheel&) = delete;
+
+   /**
+    * Arm a timer firing at when, and then every period if period is non-zero.
+    * @param earlier set to true if the owner needs to wake up before the wakeup last returned by next_wakeup()
+    */
+   template <typename Function>
+   timer_handle arm(clock::time_point when, clock::duration period, int priority, Function&& function, bool& earlier)
+   {
+      auto e = std::make_shared<detail::timer_entry>();
+      e->when_ = when;
+      e->period_ = period;
+      e->priority_ = priority;
+      e->function_ = small_handler(std::forward<Function>(function));
+      std::lock_guard<std::mutex> g(mtx_);
+      e->self_ = e;
+      link(*e, tick_of(when));
+      earlier = !wakeup_tick_ || e->tick_ < *wakeup_tick_;
+      if( earlier )
+         wakeup_tick_ = e->tick_;
+      return timer_handle(std::move(e), this);
+   }
+
+   void cancel(detail::timer_entry& e)
+   {
+      e.cancelled_ = true;
+      std::lock_guard<std::mutex> g(mtx_);
+      if( e.slot_ )
+         unlink(e);
+   }
+
+   /**
+    * Expire every timer due at or before now. Periodic timers are re-armed relative to their previous scheduled time,
+    * skipping missed periods, so they do not drift.
+    *
+    * @param dispatch called with each expired entry and its scheduled time, while the wheel's mutex is not held
+    */
+   template <typename Dispatch>
+   void expire(clock::time_point now, Dispatch&& dispatch)
+   {
+      {
+         std::lock_guard<std::mutex> g(mtx_);
+         wakeup_tick_.reset();
+         const uint64_t target = static_cast<uint64_t>((now - epoch_) / resolution_);
+         if( armed_ == 0 && current_ <= target )
+            current_ = target + 1;
+         while( current_ <= target ) {
+            const size_t index = current_ & mask(0);
+            if( index == 0 )
+               cascade(1);
+            while( detail::timer_entry* e = slots_[0][index] ) {
+               expiring_.push_back(std::move(e->self_));
+               unlink(*e);
+            }
+            ++current_;
+         }
+         expiring_.swap(dispatching_);
+      }
+      for( entry_ptr& e : dispatching_ ) {
+         const clock::time_point scheduled = e->when_;
+         if( !e->period_.count() ) {
+            e->expired_ = true;
+         } else if( !e->cancelled_ ) {
+            const auto periods = (now - e->when_) / e->period_ + 1;
+            std::lock_guard<std::mutex> g(mtx_);
+            if( !e->cancelled_ ) {
+               e->when_ += e->period_ * periods;
+               e->self_ = e;
+               link(*e, tick_of(e->when_));
+            }
+         }
+         dispatch(e, scheduled);
+      }
+      dispatching_.clear();
+   }
+
+   /**
+    * @return when the owner should next call expire(), or nothing if no timer is armed
+    */
+   std::optional<clock::time_point> next_wakeup()
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      if( armed_ == 0 ) {
+         wakeup_tick_.reset();
+         return {};
+      }
+      // first non-empty slot before level 0 wraps, otherwise the wrap itself where the next cascade happens
+      uint64_t tick = current_;
+      do {
+         if( slots_[0][tick & mask(0)] )
+            break;
+         ++tick;
+      } while( tick & mask(0) );
+      wakeup_tick_ = tick;
+      return epoch_ + resolution_ * tick;
+   }
+
+   size_t size() const
+   {
+      std::lock_guard<std::mutex> g(mtx_);
+      return armed_;
+   }
+
+private:
+   static constexpr size_t   levels        = 4;
+   static constexpr size_t   level0_bits   = 8;
+   static constexpr size_t   level_bits    = 6;
+   static constexpr size_t   level0_slots  = 1u << level0_bits;
+   static constexpr size_t   level_slots   = 1u << level_bits;
+   static constexpr uint64_t max_delta     = uint64_t(1) << (level0_bits + (levels - 1) * level_bits);
+
+   static constexpr size_t shift(size_t level) { return level == 0 ? 0 : level0_bits + (level - 1) * level_bits; }
+   static constexpr size_t mask(size_t level)  { return level == 0 ? level0_slots - 1 : level_slots - 1; }
+
+   /// first tick at or after when, so a timer never fires early
+   uint64_t tick_of(clock::time_point when) const
+   {
+      if( when <= epoch_ )
+         return 0;
+      return static_cast<uint64_t>((when - epoch_ + resolution_ - clock::duration(1)) / resolution_);
+   }
+
+   void link(detail::timer_entry& e, uint64_t tick)
+   {
+      e.tick_ = tick;
+      const uint64_t delta = tick > current_ ? tick - current_ : 0;
+      if( tick < current_ )
+         tick = current_;
+      size_t level = 0;
+      while( level + 1 < levels && delta >= (uint64_t(1) << shift(level + 1)) )
+         ++level;
+      if( delta >= max_delta )
+         tick = current_ + max_delta - 1; // re-cascaded until in range
+      detail::timer_entry*& head = slots_[level][(tick >> shift(level)) & mask(level)];
+      e.prev_ = nullptr;
+      e.next_ = head;
+      if( head )
+         head->prev_ = &e;
+      head = &e;
+      e.slot_ = &head;
+      ++armed_;
+   }
+
+   void unlink(detail::timer_entry& e)
+   {
+      if( e.prev_ )
+         e.prev_->next_ = e.next_;
+      else
+         *e.slot_ = e.next_;
+      if( e.next_ )
+         e.next_->prev_ = e.prev_;
+      e.prev_ = e.next_ = nullptr;
+      e.slot_ = nullptr;
+      --armed_;
+      e.self_.reset();
+   }
+
+   /// move the slot of level that current_ has reached down to the lower levels, recursively
+   void cascade(size_t level)
+   {
+      const size_t index = (current_ >> shift(level)) & mask(level);
+      if( index == 0 && level + 1 < levels )
+         cascade(level + 1);
+      detail::timer_entry* e = slots_[level][index];
+      slots_[level][index] = nullptr;
+      while( e ) {
+         detail::timer_entry* next = e->next_;
+         e->slot_ = nullptr;
+         --armed_;
+         link(*e, e->tick_);
+         e = next;
+      }
+   }
+
+   mutable std::mutex          mtx_;
+   const clock::duration       resolution_;
+   const clock::time_point     epoch_;
+   uint64_t                    current_ = 0; ///< next tick to process
+   size_t                      armed_ = 0;
+   std::optional<uint64_t>     wakeup_tick_;
+   detail::timer_entry*        slots_[levels][level0_slots] = {};
+   std::vector<entry_ptr>      expiring_;    ///< filled under mtx_
+   std::vector<entry_ptr>      dispatching_; ///< only touched by the thread calling expire()
+};
+
+void timer_handle::cancel()
+{
+   if( entry_ )
+      wheel_->cancel(*entry_);
+}
+
+} // appbase
@@ -0,0 +1,95 @@
+#include <appbase/execution_priority_queue.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using appbase::execution_priority_queue;
+
+namespace {
+
+   /// run the executing side until done() or timeout, @return done()
+   template <typename Done>
+   bool execute_until(execution_priority_queue& q, Done done, std::chrono::seconds timeout = std::chrono::seconds(10)) {
+      const auto deadline = std::chrono::steady_clock::now() + timeout;
+      while( !done() ) {
+         if( std::chrono::steady_clock::now() > deadline )
+            return false;
+         q.drain_incoming();
+         if( !q.execute_highest() && q.size() == 0 )
+            std::this_thread::yield();
+      }
+      return true;
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(execution_priority_queue_tests)
+
+BOOST_AUTO_TEST_CASE(block_wakes_every_waiting_producer) {
+   using namespace std::chrono_literals;
+   execution_priority_queue q;
+   const int medium = appbase::priority::medium;
+   q.set_capacity(medium, 1, execution_priority_queue::overflow_policy::block);
+   q.allow_blocking(true);
+
+   std::atomic<int> executed{0};
+   BOOST_REQUIRE(q.add(medium, [&]() { ++executed; }));
+
+   std::vector<std::thread> producers;
+   for( int i = 0; i < 3; ++i )
+      producers.emplace_back([&]() { q.add_concurrent(medium, [&]() { ++executed; }); });
+
+   const auto deadline = std::chrono::steady_clock::now() + 10s;
+   while( q.overflow(medium).blocked < 3 && std::chrono::steady_clock::now() < deadline )
+      std::this_thread::sleep_for(1ms);
+   BOOST_CHECK_EQUAL(q.overflow(medium).blocked, 3u);
+
+   const bool done = execute_until(q, [&]() { return executed == 4; });
+   q.allow_blocking(false); // releases producers should the test fail
+   for( auto& t : producers )
+      t.join();
+
+   BOOST_CHECK(done);
+   BOOST_CHECK_EQUAL(executed.load(), 4);
+   BOOST_CHECK_EQUAL(q.overflow(medium).pending, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(drop_oldest_spans_non_constant_priorities) {
+   using namespace std::chrono_literals;
+   execution_priority_queue q;
+   // priorities that are not constants share one bound
+   q.set_capacity(41, 2, execution_priority_queue::overflow_policy::drop_oldest);
+
+   std::vector<int> ran;
+   for( int p : { 41, 42, 43 } ) {
+      BOOST_REQUIRE(q.add(p, [&ran, p]() { ran.push_back(p); }));
+      std::this_thread::sleep_for(1ms); // distinct enqueue times
+   }
+   BOOST_CHECK_EQUAL(q.overflow(41).dropped, 1u);
+
+   q.execute_all();
+   BOOST_CHECK((ran == std::vector<int>{ 43, 42 }));
+}
+
+BOOST_AUTO_TEST_CASE(drop_oldest_keeps_handlers_added_before_the_capacity) {
+   execution_priority_queue q;
+   const int medium = appbase::priority::medium;
+   std::vector<int> ran;
+   for( int i = 0; i < 3; ++i )
+      BOOST_REQUIRE(q.add(medium, [&ran, i]() { ran.push_back(i); }));
+
+   q.set_capacity(medium, 1, execution_priority_queue::overflow_policy::drop_oldest);
+   for( int i = 3; i < 6; ++i )
+      BOOST_REQUIRE(q.add(medium, [&ran, i]() { ran.push_back(i); }));
+   BOOST_CHECK_EQUAL(q.overflow(medium).dropped, 2u);
+   BOOST_CHECK_EQUAL(q.overflow(medium).pending, 1u);
+
+   q.execute_all();
+   BOOST_CHECK((ran == std::vector<int>{ 0, 1, 2, 5 }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
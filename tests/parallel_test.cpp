@@ -0,0 +1,60 @@
+#include <appbase/parallel.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <future>
+#include <memory>
+
+using appbase::detail::parallel_job;
+
+namespace {
+
+   struct outcome {
+      size_t             processed = 0;
+      int                finished = 0;
+      std::exception_ptr error;
+   };
+
+   auto make_job( size_t end, size_t participants, outcome& o ) {
+      auto body = [&o]( size_t, size_t first, size_t last ) { o.processed += last - first; };
+      auto finish = [&o]( std::exception_ptr e ) { ++o.finished; o.error = e; };
+      return std::make_unique<parallel_job<decltype(body), decltype(finish)>>( 0, end, participants, body, finish );
+   }
+
+   bool is_broken_promise( const std::exception_ptr& e ) {
+      try {
+         std::rethrow_exception( e );
+      } catch( const std::future_error& fe ) {
+         return fe.code() == std::future_errc::broken_promise;
+      } catch( ... ) {
+      }
+      return false;
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(parallel_tests)
+
+BOOST_AUTO_TEST_CASE(discarded_participants_share_is_stolen) {
+   outcome o;
+   auto job = make_job( 1000, 4, o );
+   job->discard();
+   job->discard();
+   job->run( 2 );
+   job->discard();
+   BOOST_CHECK_EQUAL( o.processed, 1000u );
+   BOOST_CHECK_EQUAL( o.finished, 1 );
+   BOOST_CHECK( !o.error );
+}
+
+BOOST_AUTO_TEST_CASE(job_without_participants_reports_cancellation) {
+   outcome o;
+   auto job = make_job( 1000, 2, o );
+   job->discard();
+   job->discard();
+   BOOST_CHECK_EQUAL( o.processed, 0u );
+   BOOST_CHECK_EQUAL( o.finished, 1 );
+   BOOST_CHECK( is_broken_promise( o.error ) );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
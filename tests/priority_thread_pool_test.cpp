@@ -0,0 +1,99 @@
+#include <appbase/execution_priority_queue.hpp>
+#include <appbase/priority_thread_pool.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using appbase::priority_thread_pool;
+
+namespace {
+
+   template <typename Pred>
+   bool wait_for(Pred pred, std::chrono::seconds timeout = std::chrono::seconds(10)) {
+      const auto deadline = std::chrono::steady_clock::now() + timeout;
+      while( !pred() ) {
+         if( std::chrono::steady_clock::now() > deadline )
+            return false;
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      return true;
+   }
+
+   priority_thread_pool::scaling_config on_demand(size_t max_threads) {
+      priority_thread_pool::scaling_config config;
+      config.min_threads = 0;
+      config.max_threads = max_threads;
+      return config;
+   }
+
+}
+
+BOOST_AUTO_TEST_SUITE(priority_thread_pool_tests)
+
+BOOST_AUTO_TEST_CASE(pool_without_minimum_starts_threads_on_demand) {
+   priority_thread_pool pool;
+   std::atomic<int> ran{0};
+   pool.post(appbase::priority::medium, [&]() { ++ran; });
+   pool.start(on_demand(2));
+   BOOST_CHECK(wait_for([&]() { return ran == 1; }));
+
+   priority_thread_pool idle;
+   idle.start(on_demand(2));
+   BOOST_CHECK_EQUAL(idle.num_threads(), 0u);
+   idle.post(appbase::priority::medium, [&]() { ++ran; });
+   BOOST_CHECK(wait_for([&]() { return ran == 2; }));
+   BOOST_CHECK_EQUAL(idle.num_threads(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(discardable_handler_reports_discard) {
+   std::atomic<int> ran{0}, discarded{0};
+   {
+      priority_thread_pool pool;
+      pool.post(appbase::priority::medium, appbase::detail::make_discardable([&]() { ++ran; }, [&]() noexcept { ++discarded; }));
+      pool.stop();
+   }
+   BOOST_CHECK_EQUAL(ran.load(), 0);
+   BOOST_CHECK_EQUAL(discarded.load(), 1);
+
+   priority_thread_pool pool;
+   pool.start(1);
+   pool.post(appbase::priority::medium, appbase::detail::make_discardable([&]() { ++ran; }, [&]() noexcept { ++discarded; }));
+   BOOST_CHECK(wait_for([&]() { return ran == 1; }));
+   pool.stop();
+   BOOST_CHECK_EQUAL(discarded.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(handlers_posted_before_start_do_not_grow_for_wait) {
+   priority_thread_pool pool;
+   std::atomic<int> ran{0};
+   for( int i = 0; i < 3; ++i )
+      pool.post(appbase::priority::medium, [&]() { ++ran; });
+   std::this_thread::sleep_for(std::chrono::milliseconds(20));
+   priority_thread_pool::scaling_config config;
+   config.min_threads = 1;
+   config.max_threads = 4;
+   config.grow_wait = std::chrono::milliseconds(1);
+   pool.start(config);
+   BOOST_CHECK(wait_for([&]() { return ran == 3; }));
+   BOOST_CHECK_EQUAL(pool.scaling().grown_for_wait, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(idle_threads_retire_repeatedly) {
+   priority_thread_pool pool;
+   auto config = on_demand(2);
+   config.idle_timeout = std::chrono::milliseconds(5);
+   config.grow_interval = std::chrono::milliseconds(0);
+   pool.start(config);
+   std::atomic<int> ran{0};
+   for( int round = 1; round <= 3; ++round ) {
+      pool.post(appbase::priority::medium, [&]() { ++ran; });
+      BOOST_CHECK(wait_for([&]() { return ran == round; }));
+      BOOST_CHECK(wait_for([&]() { return pool.num_threads() == 0; }));
+   }
+   BOOST_CHECK_EQUAL(pool.scaling().shrunk, 3u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,77 @@
+#include <appbase/application.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#ifdef APPBASE_HAS_COROUTINES
+
+#include <stdexcept>
+#include <string>
+
+using namespace appbase;
+
+namespace {
+
+   /// counts live coroutine frames
+   struct frame_tracker {
+      explicit frame_tracker( int& live ) : live( live ) { ++live; }
+      ~frame_tracker() { --live; }
+      int& live;
+   };
+
+   task throw_after_yield( int& live, int& steps ) {
+      frame_tracker t( live );
+      ++steps;
+      co_await app().yield();
+      ++steps;
+      throw std::runtime_error( "after yield" );
+   }
+
+   task throw_before_suspending( int& live ) {
+      frame_tracker t( live );
+      throw std::runtime_error( "before suspending" );
+      co_return;
+   }
+
+   task complete( int& live, int& steps ) {
+      frame_tracker t( live );
+      co_await app().schedule( priority::high );
+      ++steps;
+   }
+
+   bool message_is( const std::runtime_error& e, const char* what ) { return e.what() == std::string( what ); }
+
+}
+
+BOOST_AUTO_TEST_SUITE(task_tests)
+
+BOOST_AUTO_TEST_CASE(exceptions_are_rethrown_from_exec_and_frames_destroyed) {
+   const auto dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+   const std::string config_dir = ( dir / "config" ).string(), data_dir = ( dir / "data" ).string();
+   const char* argv[] = { "appbase_test", "--config-dir", config_dir.c_str(), "--data-dir", data_dir.c_str() };
+   BOOST_REQUIRE( app().initialize<>( 5, const_cast<char**>( argv ) ) );
+   app().startup();
+
+   int live = 0, steps = 0;
+   app().post( priority::medium, [&]() { return throw_after_yield( live, steps ); } );
+   BOOST_CHECK_EXCEPTION( app().exec(), std::runtime_error, []( const auto& e ) { return message_is( e, "after yield" ); } );
+   BOOST_CHECK_EQUAL( steps, 2 );
+   BOOST_CHECK_EQUAL( live, 0 );
+
+   app().post( priority::medium, [&]() { return throw_before_suspending( live ); } );
+   BOOST_CHECK_EXCEPTION( app().exec(), std::runtime_error, []( const auto& e ) { return message_is( e, "before suspending" ); } );
+   BOOST_CHECK_EQUAL( live, 0 );
+
+   steps = 0;
+   app().post( priority::medium, [&]() { return complete( live, steps ); } );
+   app().post( priority::low, []() { app().quit(); } );
+   app().exec();
+   BOOST_CHECK_EQUAL( steps, 1 );
+   BOOST_CHECK_EQUAL( live, 0 );
+
+   boost::filesystem::remove_all( dir );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif